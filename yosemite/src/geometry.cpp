@@ -0,0 +1,900 @@
+#include "geometry.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include <fast_obj.h>
+#include <meshoptimizer.h>
+
+void loadObj(std::vector<Vertex>& vertices, const char* path)
+{
+	fastObjMesh* obj = fast_obj_read(path);
+	assert(obj);
+
+	size_t index_count = 0;
+
+	for (uint32_t i = 0; i < obj->face_count; i++)
+		index_count += 3 * (obj->face_vertices[i] - 2);
+
+	vertices.resize(index_count);
+
+	size_t vertex_offset = 0;
+	size_t index_offset = 0;
+
+	for (uint32_t i = 0; i < obj->face_count; i++)
+	{
+		for (uint32_t j = 0; j < obj->face_vertices[i]; j++)
+		{
+			fastObjIndex gi = obj->indices[index_offset + j];
+
+			if (j >= 3)
+			{
+				vertices[vertex_offset + 0] = vertices[vertex_offset - 3];
+				vertices[vertex_offset + 1] = vertices[vertex_offset - 1];
+				vertex_offset += 2;
+			}
+
+			Vertex& v = vertices[vertex_offset++];
+
+			v.vx = obj->positions[gi.p * 3 + 0];
+			v.vy = obj->positions[gi.p * 3 + 1];
+			v.vz = obj->positions[gi.p * 3 + 2];
+
+			v.nx = obj->normals[gi.n * 3 + 0];
+			v.ny = obj->normals[gi.n * 3 + 1];
+			v.nz = obj->normals[gi.n * 3 + 2];
+			
+			v.tu = obj->texcoords[gi.t * 2 + 0];
+			v.tv = obj->texcoords[gi.t * 2 + 1];
+		}
+
+		index_offset += obj->face_vertices[i];
+	}
+
+	assert(vertex_offset == index_offset);
+
+	fast_obj_destroy(obj);
+}
+
+void remapMesh(Mesh& mesh, const std::vector<Vertex>& triangle_vertices)
+{
+	size_t index_count = triangle_vertices.size();
+
+	std::vector<uint32_t> remap(index_count);
+	size_t vertex_count = meshopt_generateVertexRemap(remap.data(), 0, index_count, triangle_vertices.data(), index_count, sizeof(Vertex));
+
+	mesh.positions.resize(vertex_count);
+	mesh.attributes.resize(vertex_count);
+	mesh.indices.resize(index_count);
+
+	for (size_t i = 0; i < index_count; i++)
+	{
+		const Vertex& v = triangle_vertices[i];
+
+		mesh.positions[remap[i]] = { v.vx, v.vy, v.vz };
+		mesh.attributes[remap[i]] = { v.nx, v.ny, v.nz, v.tu, v.tv };
+	}
+
+	meshopt_remapIndexBuffer(mesh.indices.data(), 0, index_count, remap.data());
+}
+
+void optimizeMesh(Mesh& mesh)
+{
+	size_t index_count = mesh.indices.size();
+	size_t vertex_count = mesh.positions.size();
+
+	meshopt_optimizeVertexCache(mesh.indices.data(), mesh.indices.data(), index_count, vertex_count);
+
+	// One fetch order for both streams keeps them indexable by the same vertex index
+	std::vector<uint32_t> remap(vertex_count);
+	size_t unique_count = meshopt_optimizeVertexFetchRemap(remap.data(), mesh.indices.data(), index_count, vertex_count);
+
+	meshopt_remapIndexBuffer(mesh.indices.data(), mesh.indices.data(), index_count, remap.data());
+	meshopt_remapVertexBuffer(mesh.positions.data(), mesh.positions.data(), vertex_count, sizeof(VertexPosition), remap.data());
+	meshopt_remapVertexBuffer(mesh.attributes.data(), mesh.attributes.data(), vertex_count, sizeof(VertexAttributes), remap.data());
+
+	mesh.positions.resize(unique_count);
+	mesh.attributes.resize(unique_count);
+}
+
+void buildMeshlets(Mesh& mesh, size_t maxVertices, size_t maxTriangles)
+{
+	assert(maxVertices <= kMeshletMaxVertices && maxTriangles <= kMeshletMaxTriangles);
+
+	mesh.meshlets.clear();
+
+	Meshlet meshlet = {};
+	std::vector<uint8_t> meshletVertices(mesh.positions.size(), 0xff);
+
+	for (uint32_t i = 0; i < mesh.indices.size(); i += 3)
+	{
+		uint32_t a = mesh.indices[i + 0];
+		uint32_t b = mesh.indices[i + 1];
+		uint32_t c = mesh.indices[i + 2];
+
+		uint8_t& av = meshletVertices[a];
+		uint8_t& bv = meshletVertices[b];
+		uint8_t& cv = meshletVertices[c];
+
+		if (size_t(meshlet.vertexCount + (av == 0xff) + (bv == 0xff) + (cv == 0xff)) > maxVertices || meshlet.triangleCount >= maxTriangles)
+		{
+			mesh.meshlets.push_back(meshlet);
+
+			for (size_t j = 0; j < meshlet.vertexCount; j++)
+				meshletVertices[meshlet.vertices[j]] = 0xff;
+
+			meshlet = {};
+			meshlet.indexOffset = i;
+		}
+
+		if (av == 0xff)
+		{
+			av = meshlet.vertexCount;
+			meshlet.vertices[meshlet.vertexCount++] = a;
+		}
+
+		if (bv == 0xff)
+		{
+			bv = meshlet.vertexCount;
+			meshlet.vertices[meshlet.vertexCount++] = b;
+		}
+
+		if (cv == 0xff)
+		{
+			cv = meshlet.vertexCount;
+			meshlet.vertices[meshlet.vertexCount++] = c;
+		}
+
+		meshlet.indices[meshlet.triangleCount * 3 + 0] = av;
+		meshlet.indices[meshlet.triangleCount * 3 + 1] = bv;
+		meshlet.indices[meshlet.triangleCount * 3 + 2] = cv;
+		meshlet.triangleCount++;
+	}
+
+	if (meshlet.triangleCount)
+		mesh.meshlets.push_back(meshlet);
+
+	while (mesh.meshlets.size() % 32)
+		mesh.meshlets.push_back(Meshlet());
+}
+
+// Meshlet data gathered into SoA form; triangle and vertex counts are padded to a multiple of 8 so kernels can run full vectors
+struct MeshletScratch
+{
+	alignas(32) float px[64];
+	alignas(32) float py[64];
+	alignas(32) float pz[64];
+
+	alignas(32) int32_t ia[128];
+	alignas(32) int32_t ib[128];
+	alignas(32) int32_t ic[128];
+
+	alignas(32) float nx[128];
+	alignas(32) float ny[128];
+	alignas(32) float nz[128];
+};
+
+struct MeshletBoundsResult
+{
+	float normal[3]; // sum of unit triangle normals
+	float mindp;
+	float min[3];
+	float max[3];
+	float radius2;
+};
+
+static void gatherMeshlet(MeshletScratch& scratch, const Meshlet& meshlet, const VertexPosition* positions)
+{
+	for (unsigned int i = 0; i < meshlet.vertexCount; ++i)
+	{
+		const VertexPosition& v = positions[meshlet.vertices[i]];
+
+		scratch.px[i] = v.vx;
+		scratch.py[i] = v.vy;
+		scratch.pz[i] = v.vz;
+	}
+
+	// Replicating the first vertex keeps padded lanes neutral for min/max/radius
+	for (unsigned int i = meshlet.vertexCount; i < ((meshlet.vertexCount + 7) & ~7u); ++i)
+	{
+		scratch.px[i] = scratch.px[0];
+		scratch.py[i] = scratch.py[0];
+		scratch.pz[i] = scratch.pz[0];
+	}
+
+	for (unsigned int i = 0; i < meshlet.triangleCount; ++i)
+	{
+		scratch.ia[i] = meshlet.indices[i * 3 + 0];
+		scratch.ib[i] = meshlet.indices[i * 3 + 1];
+		scratch.ic[i] = meshlet.indices[i * 3 + 2];
+	}
+
+	// Padded triangles are degenerate and produce zero normals; kernels mask them out of the minimum
+	for (unsigned int i = meshlet.triangleCount; i < ((meshlet.triangleCount + 7) & ~7u); ++i)
+	{
+		scratch.ia[i] = 0;
+		scratch.ib[i] = 0;
+		scratch.ic[i] = 0;
+	}
+}
+
+static void computeBoundsScalar(MeshletBoundsResult& result, MeshletScratch& scratch, unsigned int triangleCount, unsigned int vertexCount)
+{
+	float sum[3] = {};
+
+	for (unsigned int i = 0; i < triangleCount; ++i)
+	{
+		int a = scratch.ia[i], b = scratch.ib[i], c = scratch.ic[i];
+
+		float p10[3] = { scratch.px[b] - scratch.px[a], scratch.py[b] - scratch.py[a], scratch.pz[b] - scratch.pz[a] };
+		float p20[3] = { scratch.px[c] - scratch.px[a], scratch.py[c] - scratch.py[a], scratch.pz[c] - scratch.pz[a] };
+
+		float normalx = p10[1] * p20[2] - p10[2] * p20[1];
+		float normaly = p10[2] * p20[0] - p10[0] * p20[2];
+		float normalz = p10[0] * p20[1] - p10[1] * p20[0];
+
+		float area = sqrtf(normalx * normalx + normaly * normaly + normalz * normalz);
+		float invarea = area == 0.f ? 0.f : 1 / area;
+
+		scratch.nx[i] = normalx * invarea;
+		scratch.ny[i] = normaly * invarea;
+		scratch.nz[i] = normalz * invarea;
+
+		sum[0] += scratch.nx[i];
+		sum[1] += scratch.ny[i];
+		sum[2] += scratch.nz[i];
+	}
+
+	float bmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float bmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (unsigned int i = 0; i < vertexCount; ++i)
+	{
+		bmin[0] = std::min(bmin[0], scratch.px[i]);
+		bmin[1] = std::min(bmin[1], scratch.py[i]);
+		bmin[2] = std::min(bmin[2], scratch.pz[i]);
+		bmax[0] = std::max(bmax[0], scratch.px[i]);
+		bmax[1] = std::max(bmax[1], scratch.py[i]);
+		bmax[2] = std::max(bmax[2], scratch.pz[i]);
+	}
+
+	float center[3] = { (bmin[0] + bmax[0]) * 0.5f, (bmin[1] + bmax[1]) * 0.5f, (bmin[2] + bmax[2]) * 0.5f };
+	float radius2 = 0.f;
+
+	for (unsigned int i = 0; i < vertexCount; ++i)
+	{
+		float dx = scratch.px[i] - center[0], dy = scratch.py[i] - center[1], dz = scratch.pz[i] - center[2];
+
+		radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+	}
+
+	memcpy(result.normal, sum, sizeof(sum));
+	memcpy(result.min, bmin, sizeof(bmin));
+	memcpy(result.max, bmax, sizeof(bmax));
+	result.radius2 = radius2;
+}
+
+static float computeMinDotScalar(const MeshletScratch& scratch, unsigned int triangleCount, const float axis[3])
+{
+	float mindp = 1.f;
+
+	for (unsigned int i = 0; i < triangleCount; ++i)
+	{
+		float dp = scratch.nx[i] * axis[0] + scratch.ny[i] * axis[1] + scratch.nz[i] * axis[2];
+
+		mindp = std::min(mindp, dp);
+	}
+
+	return mindp;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+static float hsum(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+static float hmin(__m128 v)
+{
+	v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_min_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+static float hmax(__m128 v)
+{
+	v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+static __m128 gather4(const float* data, const int32_t* index)
+{
+	return _mm_setr_ps(data[index[0]], data[index[1]], data[index[2]], data[index[3]]);
+}
+
+// SSE2 only, which every x64 CPU has
+static void computeBoundsSSE(MeshletBoundsResult& result, MeshletScratch& scratch, unsigned int triangleCount, unsigned int vertexCount)
+{
+	__m128 sumx = _mm_setzero_ps(), sumy = _mm_setzero_ps(), sumz = _mm_setzero_ps();
+
+	for (unsigned int i = 0; i < triangleCount; i += 4)
+	{
+		__m128 ax = gather4(scratch.px, &scratch.ia[i]), ay = gather4(scratch.py, &scratch.ia[i]), az = gather4(scratch.pz, &scratch.ia[i]);
+		__m128 bx = gather4(scratch.px, &scratch.ib[i]), by = gather4(scratch.py, &scratch.ib[i]), bz = gather4(scratch.pz, &scratch.ib[i]);
+		__m128 cx = gather4(scratch.px, &scratch.ic[i]), cy = gather4(scratch.py, &scratch.ic[i]), cz = gather4(scratch.pz, &scratch.ic[i]);
+
+		__m128 p10x = _mm_sub_ps(bx, ax), p10y = _mm_sub_ps(by, ay), p10z = _mm_sub_ps(bz, az);
+		__m128 p20x = _mm_sub_ps(cx, ax), p20y = _mm_sub_ps(cy, ay), p20z = _mm_sub_ps(cz, az);
+
+		__m128 normalx = _mm_sub_ps(_mm_mul_ps(p10y, p20z), _mm_mul_ps(p10z, p20y));
+		__m128 normaly = _mm_sub_ps(_mm_mul_ps(p10z, p20x), _mm_mul_ps(p10x, p20z));
+		__m128 normalz = _mm_sub_ps(_mm_mul_ps(p10x, p20y), _mm_mul_ps(p10y, p20x));
+
+		__m128 area = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(normalx, normalx), _mm_mul_ps(normaly, normaly)), _mm_mul_ps(normalz, normalz)));
+		__m128 invarea = _mm_and_ps(_mm_cmpneq_ps(area, _mm_setzero_ps()), _mm_div_ps(_mm_set1_ps(1.f), area));
+
+		normalx = _mm_mul_ps(normalx, invarea);
+		normaly = _mm_mul_ps(normaly, invarea);
+		normalz = _mm_mul_ps(normalz, invarea);
+
+		_mm_store_ps(&scratch.nx[i], normalx);
+		_mm_store_ps(&scratch.ny[i], normaly);
+		_mm_store_ps(&scratch.nz[i], normalz);
+
+		sumx = _mm_add_ps(sumx, normalx);
+		sumy = _mm_add_ps(sumy, normaly);
+		sumz = _mm_add_ps(sumz, normalz);
+	}
+
+	__m128 minx = _mm_set1_ps(FLT_MAX), miny = minx, minz = minx;
+	__m128 maxx = _mm_set1_ps(-FLT_MAX), maxy = maxx, maxz = maxx;
+
+	for (unsigned int i = 0; i < vertexCount; i += 4)
+	{
+		__m128 x = _mm_load_ps(&scratch.px[i]), y = _mm_load_ps(&scratch.py[i]), z = _mm_load_ps(&scratch.pz[i]);
+
+		minx = _mm_min_ps(minx, x), miny = _mm_min_ps(miny, y), minz = _mm_min_ps(minz, z);
+		maxx = _mm_max_ps(maxx, x), maxy = _mm_max_ps(maxy, y), maxz = _mm_max_ps(maxz, z);
+	}
+
+	result.min[0] = hmin(minx), result.min[1] = hmin(miny), result.min[2] = hmin(minz);
+	result.max[0] = hmax(maxx), result.max[1] = hmax(maxy), result.max[2] = hmax(maxz);
+
+	__m128 centerx = _mm_set1_ps((result.min[0] + result.max[0]) * 0.5f);
+	__m128 centery = _mm_set1_ps((result.min[1] + result.max[1]) * 0.5f);
+	__m128 centerz = _mm_set1_ps((result.min[2] + result.max[2]) * 0.5f);
+
+	__m128 radius2 = _mm_setzero_ps();
+
+	for (unsigned int i = 0; i < vertexCount; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_load_ps(&scratch.px[i]), centerx);
+		__m128 dy = _mm_sub_ps(_mm_load_ps(&scratch.py[i]), centery);
+		__m128 dz = _mm_sub_ps(_mm_load_ps(&scratch.pz[i]), centerz);
+
+		radius2 = _mm_max_ps(radius2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+	}
+
+	result.normal[0] = hsum(sumx), result.normal[1] = hsum(sumy), result.normal[2] = hsum(sumz);
+	result.radius2 = hmax(radius2);
+}
+
+static float computeMinDotSSE(const MeshletScratch& scratch, unsigned int triangleCount, const float axis[3])
+{
+	__m128 axisx = _mm_set1_ps(axis[0]), axisy = _mm_set1_ps(axis[1]), axisz = _mm_set1_ps(axis[2]);
+	__m128 mindp = _mm_set1_ps(1.f);
+
+	for (unsigned int i = 0; i < triangleCount; i += 4)
+	{
+		__m128 dp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(&scratch.nx[i]), axisx), _mm_mul_ps(_mm_load_ps(&scratch.ny[i]), axisy)), _mm_mul_ps(_mm_load_ps(&scratch.nz[i]), axisz));
+
+		// Padded lanes keep the neutral 1.0
+		__m128 valid = _mm_castsi128_ps(_mm_cmplt_epi32(_mm_setr_epi32(i + 0, i + 1, i + 2, i + 3), _mm_set1_epi32(int(triangleCount))));
+
+		mindp = _mm_min_ps(mindp, _mm_or_ps(_mm_and_ps(valid, dp), _mm_andnot_ps(valid, _mm_set1_ps(1.f))));
+	}
+
+	return hmin(mindp);
+}
+
+#if defined(__GNUC__)
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+SIMD_TARGET_AVX2 static __m128 combine(__m256 v)
+{
+	return _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+}
+
+SIMD_TARGET_AVX2 static void computeBoundsAVX2(MeshletBoundsResult& result, MeshletScratch& scratch, unsigned int triangleCount, unsigned int vertexCount)
+{
+	__m256 sumx = _mm256_setzero_ps(), sumy = _mm256_setzero_ps(), sumz = _mm256_setzero_ps();
+
+	for (unsigned int i = 0; i < triangleCount; i += 8)
+	{
+		__m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(&scratch.ia[i]));
+		__m256i b = _mm256_load_si256(reinterpret_cast<const __m256i*>(&scratch.ib[i]));
+		__m256i c = _mm256_load_si256(reinterpret_cast<const __m256i*>(&scratch.ic[i]));
+
+		__m256 ax = _mm256_i32gather_ps(scratch.px, a, 4), ay = _mm256_i32gather_ps(scratch.py, a, 4), az = _mm256_i32gather_ps(scratch.pz, a, 4);
+		__m256 bx = _mm256_i32gather_ps(scratch.px, b, 4), by = _mm256_i32gather_ps(scratch.py, b, 4), bz = _mm256_i32gather_ps(scratch.pz, b, 4);
+		__m256 cx = _mm256_i32gather_ps(scratch.px, c, 4), cy = _mm256_i32gather_ps(scratch.py, c, 4), cz = _mm256_i32gather_ps(scratch.pz, c, 4);
+
+		__m256 p10x = _mm256_sub_ps(bx, ax), p10y = _mm256_sub_ps(by, ay), p10z = _mm256_sub_ps(bz, az);
+		__m256 p20x = _mm256_sub_ps(cx, ax), p20y = _mm256_sub_ps(cy, ay), p20z = _mm256_sub_ps(cz, az);
+
+		__m256 normalx = _mm256_sub_ps(_mm256_mul_ps(p10y, p20z), _mm256_mul_ps(p10z, p20y));
+		__m256 normaly = _mm256_sub_ps(_mm256_mul_ps(p10z, p20x), _mm256_mul_ps(p10x, p20z));
+		__m256 normalz = _mm256_sub_ps(_mm256_mul_ps(p10x, p20y), _mm256_mul_ps(p10y, p20x));
+
+		__m256 area = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(normalx, normalx), _mm256_mul_ps(normaly, normaly)), _mm256_mul_ps(normalz, normalz)));
+		__m256 invarea = _mm256_and_ps(_mm256_cmp_ps(area, _mm256_setzero_ps(), _CMP_NEQ_OQ), _mm256_div_ps(_mm256_set1_ps(1.f), area));
+
+		normalx = _mm256_mul_ps(normalx, invarea);
+		normaly = _mm256_mul_ps(normaly, invarea);
+		normalz = _mm256_mul_ps(normalz, invarea);
+
+		_mm256_store_ps(&scratch.nx[i], normalx);
+		_mm256_store_ps(&scratch.ny[i], normaly);
+		_mm256_store_ps(&scratch.nz[i], normalz);
+
+		sumx = _mm256_add_ps(sumx, normalx);
+		sumy = _mm256_add_ps(sumy, normaly);
+		sumz = _mm256_add_ps(sumz, normalz);
+	}
+
+	__m256 minx = _mm256_set1_ps(FLT_MAX), miny = minx, minz = minx;
+	__m256 maxx = _mm256_set1_ps(-FLT_MAX), maxy = maxx, maxz = maxx;
+
+	for (unsigned int i = 0; i < vertexCount; i += 8)
+	{
+		__m256 x = _mm256_load_ps(&scratch.px[i]), y = _mm256_load_ps(&scratch.py[i]), z = _mm256_load_ps(&scratch.pz[i]);
+
+		minx = _mm256_min_ps(minx, x), miny = _mm256_min_ps(miny, y), minz = _mm256_min_ps(minz, z);
+		maxx = _mm256_max_ps(maxx, x), maxy = _mm256_max_ps(maxy, y), maxz = _mm256_max_ps(maxz, z);
+	}
+
+	result.min[0] = hmin(_mm_min_ps(_mm256_castps256_ps128(minx), _mm256_extractf128_ps(minx, 1)));
+	result.min[1] = hmin(_mm_min_ps(_mm256_castps256_ps128(miny), _mm256_extractf128_ps(miny, 1)));
+	result.min[2] = hmin(_mm_min_ps(_mm256_castps256_ps128(minz), _mm256_extractf128_ps(minz, 1)));
+	result.max[0] = hmax(_mm_max_ps(_mm256_castps256_ps128(maxx), _mm256_extractf128_ps(maxx, 1)));
+	result.max[1] = hmax(_mm_max_ps(_mm256_castps256_ps128(maxy), _mm256_extractf128_ps(maxy, 1)));
+	result.max[2] = hmax(_mm_max_ps(_mm256_castps256_ps128(maxz), _mm256_extractf128_ps(maxz, 1)));
+
+	__m256 centerx = _mm256_set1_ps((result.min[0] + result.max[0]) * 0.5f);
+	__m256 centery = _mm256_set1_ps((result.min[1] + result.max[1]) * 0.5f);
+	__m256 centerz = _mm256_set1_ps((result.min[2] + result.max[2]) * 0.5f);
+
+	__m256 radius2 = _mm256_setzero_ps();
+
+	for (unsigned int i = 0; i < vertexCount; i += 8)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_load_ps(&scratch.px[i]), centerx);
+		__m256 dy = _mm256_sub_ps(_mm256_load_ps(&scratch.py[i]), centery);
+		__m256 dz = _mm256_sub_ps(_mm256_load_ps(&scratch.pz[i]), centerz);
+
+		radius2 = _mm256_max_ps(radius2, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+	}
+
+	result.normal[0] = hsum(combine(sumx)), result.normal[1] = hsum(combine(sumy)), result.normal[2] = hsum(combine(sumz));
+	result.radius2 = hmax(_mm_max_ps(_mm256_castps256_ps128(radius2), _mm256_extractf128_ps(radius2, 1)));
+}
+
+SIMD_TARGET_AVX2 static float computeMinDotAVX2(const MeshletScratch& scratch, unsigned int triangleCount, const float axis[3])
+{
+	__m256 axisx = _mm256_set1_ps(axis[0]), axisy = _mm256_set1_ps(axis[1]), axisz = _mm256_set1_ps(axis[2]);
+	__m256 mindp = _mm256_set1_ps(1.f);
+
+	for (unsigned int i = 0; i < triangleCount; i += 8)
+	{
+		__m256 dp = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(&scratch.nx[i]), axisx), _mm256_mul_ps(_mm256_load_ps(&scratch.ny[i]), axisy)), _mm256_mul_ps(_mm256_load_ps(&scratch.nz[i]), axisz));
+
+		// Padded lanes keep the neutral 1.0
+		__m256i lane = _mm256_add_epi32(_mm256_set1_epi32(int(i)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		__m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(int(triangleCount)), lane));
+
+		mindp = _mm256_min_ps(mindp, _mm256_blendv_ps(_mm256_set1_ps(1.f), dp, valid));
+	}
+
+	return hmin(_mm_min_ps(_mm256_castps256_ps128(mindp), _mm256_extractf128_ps(mindp, 1)));
+}
+
+static bool hasAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4] = {};
+	__cpuid(info, 0);
+
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+
+	// AVX state has to be enabled by the OS (OSXSAVE + XCR0 bits 1 and 2)
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+SimdLevel getSimdLevel()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	static SimdLevel level = hasAVX2() ? SimdLevel_AVX2 : SimdLevel_SSE;
+	return level;
+#else
+	return SimdLevel_Scalar;
+#endif
+}
+
+void buildMeshletCones(Mesh& mesh, SimdLevel level)
+{
+	mesh.meshletBounds.resize(mesh.meshlets.size());
+
+	MeshletScratch scratch;
+
+	for (size_t mi = 0; mi < mesh.meshlets.size(); ++mi)
+	{
+		Meshlet& meshlet = mesh.meshlets[mi];
+		MeshletBounds& bounds = mesh.meshletBounds[mi];
+
+		if (meshlet.vertexCount == 0)
+		{
+			meshlet.cone[0] = 1.f;
+			meshlet.cone[1] = meshlet.cone[2] = meshlet.cone[3] = 0.f;
+			meshlet.center[0] = meshlet.center[1] = meshlet.center[2] = meshlet.radius = 0.f;
+			bounds = {};
+			continue;
+		}
+
+		gatherMeshlet(scratch, meshlet, mesh.positions.data());
+
+		MeshletBoundsResult result = {};
+
+		switch (level)
+		{
+#if defined(__x86_64__) || defined(_M_X64)
+		case SimdLevel_AVX2:
+			computeBoundsAVX2(result, scratch, meshlet.triangleCount, meshlet.vertexCount);
+			break;
+		case SimdLevel_SSE:
+			computeBoundsSSE(result, scratch, meshlet.triangleCount, meshlet.vertexCount);
+			break;
+#endif
+		default:
+			computeBoundsScalar(result, scratch, meshlet.triangleCount, meshlet.vertexCount);
+		}
+
+		float avgnormal[3] = { result.normal[0], result.normal[1], result.normal[2] };
+		float avglength = sqrtf(avgnormal[0] * avgnormal[0] + avgnormal[1] * avgnormal[1] + avgnormal[2] * avgnormal[2]);
+
+		if (avglength == 0.f)
+		{
+			avgnormal[0] = 1.f;
+			avgnormal[1] = 0.f;
+			avgnormal[2] = 0.f;
+		}
+		else
+		{
+			avgnormal[0] /= avglength;
+			avgnormal[1] /= avglength;
+			avgnormal[2] /= avglength;
+		}
+
+		// The minimum needs the final axis, so it runs over the normals cached in scratch rather than the mesh
+		float mindp;
+
+		switch (level)
+		{
+#if defined(__x86_64__) || defined(_M_X64)
+		case SimdLevel_AVX2:
+			mindp = computeMinDotAVX2(scratch, meshlet.triangleCount, avgnormal);
+			break;
+		case SimdLevel_SSE:
+			mindp = computeMinDotSSE(scratch, meshlet.triangleCount, avgnormal);
+			break;
+#endif
+		default:
+			mindp = computeMinDotScalar(scratch, meshlet.triangleCount, avgnormal);
+		}
+
+		float conew = mindp <= 0.f ? 1 : sqrtf(1 - mindp * mindp);
+
+		meshlet.cone[0] = avgnormal[0];
+		meshlet.cone[1] = avgnormal[1];
+		meshlet.cone[2] = avgnormal[2];
+		meshlet.cone[3] = conew;
+
+		// Bounding sphere around the AABB center, used for frustum culling and software raster routing
+		meshlet.center[0] = (result.min[0] + result.max[0]) * 0.5f;
+		meshlet.center[1] = (result.min[1] + result.max[1]) * 0.5f;
+		meshlet.center[2] = (result.min[2] + result.max[2]) * 0.5f;
+		meshlet.radius = sqrtf(result.radius2);
+
+		memcpy(bounds.min, result.min, sizeof(bounds.min));
+		memcpy(bounds.max, result.max, sizeof(bounds.max));
+	}
+}
+
+void buildMeshletCones(Mesh& mesh)
+{
+	buildMeshletCones(mesh, getSimdLevel());
+}
+
+// Spreads the low 10 bits of v so that there are two zero bits between each of them
+static uint32_t mortonPart(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+void optimizeMeshletOrder(Mesh& mesh)
+{
+	// Padding meshlets stay at the end, after every meshlet with triangles
+	size_t meshletCount = 0;
+	while (meshletCount < mesh.meshlets.size() && mesh.meshlets[meshletCount].triangleCount)
+		meshletCount++;
+
+	if (meshletCount == 0)
+		return;
+
+	float bmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float bmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (size_t mi = 0; mi < meshletCount; ++mi)
+		for (int k = 0; k < 3; ++k)
+		{
+			bmin[k] = std::min(bmin[k], mesh.meshlets[mi].center[k]);
+			bmax[k] = std::max(bmax[k], mesh.meshlets[mi].center[k]);
+		}
+
+	float extent = std::max(bmax[0] - bmin[0], std::max(bmax[1] - bmin[1], bmax[2] - bmin[2]));
+	float scale = extent > 0.f ? 1023.f / extent : 0.f;
+
+	// Sorting by the Morton code of meshlet centers keeps meshlets that share a task workgroup close in space
+	std::vector<uint64_t> keys(meshletCount);
+
+	for (size_t mi = 0; mi < meshletCount; ++mi)
+	{
+		const float* center = mesh.meshlets[mi].center;
+
+		uint32_t x = uint32_t((center[0] - bmin[0]) * scale + 0.5f);
+		uint32_t y = uint32_t((center[1] - bmin[1]) * scale + 0.5f);
+		uint32_t z = uint32_t((center[2] - bmin[2]) * scale + 0.5f);
+
+		uint32_t code = mortonPart(x) | (mortonPart(y) << 1) | (mortonPart(z) << 2);
+
+		// The original index breaks ties deterministically and is recovered from the low bits after sorting
+		keys[mi] = (uint64_t(code) << 32) | mi;
+	}
+
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<Meshlet> meshlets(mesh.meshlets.begin(), mesh.meshlets.end());
+	std::vector<MeshletBounds> bounds(mesh.meshletBounds.begin(), mesh.meshletBounds.end());
+	std::vector<uint32_t> indices(mesh.indices.size());
+
+	// Triangles move with their meshlets so that every meshlet still covers a contiguous index range
+	uint32_t indexOffset = 0;
+
+	for (size_t i = 0; i < meshletCount; ++i)
+	{
+		uint32_t mi = uint32_t(keys[i]);
+
+		Meshlet& meshlet = mesh.meshlets[i];
+		meshlet = meshlets[mi];
+
+		if (!bounds.empty())
+			mesh.meshletBounds[i] = bounds[mi];
+
+		memcpy(&indices[indexOffset], &mesh.indices[meshlet.indexOffset], meshlet.triangleCount * 3 * sizeof(uint32_t));
+
+		meshlet.indexOffset = indexOffset;
+		indexOffset += meshlet.triangleCount * 3;
+	}
+
+	assert(indexOffset == mesh.indices.size());
+
+	mesh.indices.swap(indices);
+
+	// Vertices are renumbered in order of first use by the sorted meshlets, so each meshlet reads a compact range of both streams
+	// Numbering restarts in a new 64K window whenever the current one is full, so a meshlet never references vertices more than 64K apart and index chunks can stay 16-bit; vertices shared with an earlier window are duplicated
+	size_t vertexCount = mesh.positions.size();
+
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint32_t> remapWindow(vertexCount, ~0u);
+
+	std::vector<VertexPosition> positions;
+	std::vector<VertexAttributes> attributes;
+	positions.reserve(vertexCount);
+	attributes.reserve(vertexCount);
+
+	uint32_t window = 0;
+	size_t windowStart = 0;
+
+	for (size_t mi = 0; mi < meshletCount; ++mi)
+	{
+		Meshlet& meshlet = mesh.meshlets[mi];
+
+		size_t newVertices = 0;
+		for (size_t i = 0; i < meshlet.vertexCount; ++i)
+			newVertices += remapWindow[meshlet.vertices[i]] != window;
+
+		if (positions.size() + newVertices - windowStart > 0x10000)
+		{
+			window++;
+			windowStart = positions.size();
+		}
+
+		for (size_t i = 0; i < meshlet.vertexCount; ++i)
+		{
+			uint32_t v = meshlet.vertices[i];
+
+			if (remapWindow[v] != window)
+			{
+				remapWindow[v] = window;
+				remap[v] = uint32_t(positions.size());
+
+				positions.push_back(mesh.positions[v]);
+				attributes.push_back(mesh.attributes[v]);
+			}
+
+			meshlet.vertices[i] = remap[v];
+		}
+
+		// Meshlet vertices cover every vertex its triangles reference, so the window mapping is complete for them
+		for (size_t i = 0; i < meshlet.triangleCount * 3u; ++i)
+		{
+			uint32_t& index = mesh.indices[meshlet.indexOffset + i];
+
+			assert(remapWindow[index] == window);
+			index = remap[index];
+		}
+	}
+
+	mesh.positions.swap(positions);
+	mesh.attributes.swap(attributes);
+}
+
+void buildIndexChunks(Mesh& mesh)
+{
+	mesh.indices16.clear();
+	mesh.indexChunks.clear();
+
+	// Meshlet draws take the vertexOffset of a single chunk, so chunks are only split between meshlets; without meshlets any triangle can start a chunk
+	bool meshlets = !mesh.meshlets.empty();
+
+	IndexChunk chunk = {};
+	uint32_t chunkMin = ~0u, chunkMax = 0;
+	size_t chunkMeshlet = 0, meshletIndex = 0;
+
+	for (size_t i = 0; i < mesh.indices.size(); )
+	{
+		size_t groupEnd = i + 3;
+
+		if (meshlets)
+		{
+			assert(mesh.meshlets[meshletIndex].indexOffset == i);
+			groupEnd = i + mesh.meshlets[meshletIndex].triangleCount * 3;
+		}
+
+		uint32_t groupMin = ~0u, groupMax = 0;
+
+		for (size_t j = i; j < groupEnd; ++j)
+		{
+			groupMin = std::min(groupMin, mesh.indices[j]);
+			groupMax = std::max(groupMax, mesh.indices[j]);
+		}
+
+		// A single meshlet spanning more than 64K vertices can't be drawn with 16-bit indices at all
+		if (groupMax - groupMin > 0xffff)
+		{
+			mesh.indexChunks.clear();
+			break;
+		}
+
+		if (chunk.indexCount && std::max(chunkMax, groupMax) - std::min(chunkMin, groupMin) > 0xffff)
+		{
+			chunk.vertexOffset = chunkMin;
+			mesh.indexChunks.push_back(chunk);
+
+			for (size_t j = chunkMeshlet; j < meshletIndex; ++j)
+				mesh.meshlets[j].vertexOffset = chunkMin;
+
+			chunk = {};
+			chunk.indexOffset = uint32_t(i);
+			chunkMin = ~0u;
+			chunkMax = 0;
+			chunkMeshlet = meshletIndex;
+		}
+
+		chunkMin = std::min(chunkMin, groupMin);
+		chunkMax = std::max(chunkMax, groupMax);
+		chunk.indexCount += uint32_t(groupEnd - i);
+
+		if (meshlets)
+			meshletIndex++;
+
+		i = groupEnd;
+
+		if (i == mesh.indices.size())
+		{
+			chunk.vertexOffset = chunkMin;
+			mesh.indexChunks.push_back(chunk);
+
+			for (size_t j = chunkMeshlet; j < meshletIndex; ++j)
+				mesh.meshlets[j].vertexOffset = chunkMin;
+		}
+	}
+
+	if (mesh.indexChunks.empty())
+	{
+		// 32-bit fallback: the whole index buffer is drawn as is
+		IndexChunk all = { 0, uint32_t(mesh.indices.size()), 0 };
+		mesh.indexChunks.push_back(all);
+
+		for (Meshlet& meshlet : mesh.meshlets)
+			meshlet.vertexOffset = 0;
+
+		return;
+	}
+
+	mesh.indices16.resize(mesh.indices.size());
+
+	for (const IndexChunk& c : mesh.indexChunks)
+		for (size_t j = c.indexOffset; j < c.indexOffset + c.indexCount; ++j)
+			mesh.indices16[j] = uint16_t(mesh.indices[j] - c.vertexOffset);
+}
+
+void buildMeshletData(Mesh& mesh, size_t maxVertices, size_t maxTriangles)
+{
+	buildMeshlets(mesh, maxVertices, maxTriangles);
+	buildMeshletCones(mesh);
+	optimizeMeshletOrder(mesh);
+
+	// Chunk boundaries fall between meshlets and set their vertexOffset, so chunks have to be rebuilt with the meshlets
+	buildIndexChunks(mesh);
+}
+
+void loadMesh(Mesh& mesh, const char* path, bool meshlets, size_t maxVertices, size_t maxTriangles, Mesh* optimized)
+{
+	std::vector<Vertex> triangle_vertices;
+	loadObj(triangle_vertices, path);
+
+	remapMesh(mesh, triangle_vertices);
+	optimizeMesh(mesh);
+
+	if (optimized)
+		*optimized = mesh;
+
+	if (meshlets)
+		buildMeshletData(mesh, maxVertices, maxTriangles);
+	else
+		buildIndexChunks(mesh);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+struct Vertex
+{
+	float vx, vy, vz;
+	float nx, ny, nz;
+	float tu, tv;
+};
+
+// Mesh vertex data is stored as two streams so that passes which only need positions (culling, visibility, software raster) read 12 bytes per vertex instead of 32
+struct VertexPosition
+{
+	float vx, vy, vz;
+};
+
+struct VertexAttributes
+{
+	float nx, ny, nz;
+	float tu, tv;
+};
+
+// Storage limits; buildMeshlets can produce smaller meshlets, and the mesh shaders declare these as max_vertices/max_primitives
+const size_t kMeshletMaxVertices = 64;
+const size_t kMeshletMaxTriangles = 124;
+
+struct alignas(16) Meshlet
+{
+	float cone[4];
+	float center[3];
+	float radius;
+	uint32_t vertices[kMeshletMaxVertices];
+	uint8_t indices[kMeshletMaxTriangles*3];
+	uint32_t indexOffset; // first index of the meshlet triangles in Mesh::indices
+	uint32_t vertexOffset; // base vertex of the index chunk containing the meshlet, see Mesh::indexChunks
+	uint8_t triangleCount;
+	uint8_t vertexCount;
+};
+
+struct MeshletBounds
+{
+	float min[3];
+	float max[3];
+};
+
+// Range of Mesh::indices whose vertices all fit in 64K after vertexOffset is subtracted
+struct IndexChunk
+{
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	uint32_t vertexOffset;
+};
+
+struct Mesh
+{
+	std::vector<VertexPosition> positions;
+	std::vector<VertexAttributes> attributes; // parallel to positions
+	std::vector<uint32_t> indices;
+	std::vector<uint16_t> indices16; // indices relative to the vertexOffset of their chunk; empty if the mesh needs 32-bit indices
+	std::vector<IndexChunk> indexChunks; // one chunk covering all indices when indices16 is empty
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshletBounds> meshletBounds; // CPU-only, parallel to meshlets
+};
+
+enum SimdLevel
+{
+	SimdLevel_Scalar,
+	SimdLevel_SSE,
+	SimdLevel_AVX2,
+};
+
+// Highest instruction set the cone/bounds kernels can use on this CPU
+SimdLevel getSimdLevel();
+
+// Preprocessing stages in the order loadMesh runs them; exposed separately so that meshbench can time each one
+void loadObj(std::vector<Vertex>& vertices, const char* path);
+void remapMesh(Mesh& mesh, const std::vector<Vertex>& triangleVertices);
+void optimizeMesh(Mesh& mesh);
+void buildMeshlets(Mesh& mesh, size_t maxVertices = kMeshletMaxVertices, size_t maxTriangles = kMeshletMaxTriangles);
+void buildMeshletCones(Mesh& mesh);
+void buildMeshletCones(Mesh& mesh, SimdLevel level);
+void optimizeMeshletOrder(Mesh& mesh);
+void buildIndexChunks(Mesh& mesh);
+
+// Everything loadMesh does after optimizeMesh when meshlets are requested: meshlets, cones, meshlet order (which renumbers vertices in 64K windows, duplicating the ones shared between windows) and index chunks
+void buildMeshletData(Mesh& mesh, size_t maxVertices, size_t maxTriangles);
+
+// optimized receives the mesh as it was before the meshlet stages, so that buildMeshletData can rebuild it with other limits
+void loadMesh(Mesh& mesh, const char* path, bool meshlets, size_t maxVertices = kMeshletMaxVertices, size_t maxTriangles = kMeshletMaxTriangles, Mesh* optimized = 0);
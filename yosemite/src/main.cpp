@@ -1,7 +1,18 @@
 
 #include <assert.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
-
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #define GLFW_INCLUDE_NONE
@@ -10,8 +21,8 @@
 
 #include <volk.h>
 
-#include <fast_obj.h>
-#include <meshoptimizer.h>
+#include "geometry.h"
+#include "shaders.h"
 
 #define VK_CHECK(vkcall)					\
 		{									\
@@ -21,30 +32,132 @@
 
 #define VSYNC 0
 #define RTX 1
+#define CULL_PREPASS 1
+#define VISBUFFER 0
+#define SWRASTER 0
+#define STATIC_COMMANDS 0
+#define DYNAMIC_RESOLUTION 0
+#define CULL_STATS 0
+#define MULTIVIEW 0
+#define VERTEX_INPUT 0
+#define ASYNC_LOAD 1
+
+// Views are culled per meshlet in the task shader and rendered into the layers of the offscreen color target
+#if MULTIVIEW && (!RTX || CULL_PREPASS || VISBUFFER)
+#error MULTIVIEW requires RTX without CULL_PREPASS or VISBUFFER
+#endif
+
+// Color is rendered offscreen and blitted to the swapchain image: below the swapchain resolution with DYNAMIC_RESOLUTION, one layer per view with MULTIVIEW
+#define OFFSCREEN_COLOR (DYNAMIC_RESOLUTION || MULTIVIEW)
+
+// Fixed-function vertex fetch replaces storage buffer pulling in mesh.vert; the other vertex and mesh shaders always pull
+#if VERTEX_INPUT && (RTX || VISBUFFER)
+#error VERTEX_INPUT requires the classic vertex shader path (no RTX or VISBUFFER)
+#endif
+
+#if VISBUFFER && !(RTX || CULL_PREPASS)
+#error Visibility buffer requires meshlets (RTX or CULL_PREPASS)
+#endif
+
+#if SWRASTER && !(VISBUFFER && CULL_PREPASS)
+#error Software rasterization requires VISBUFFER and CULL_PREPASS
+#endif
+
+// Per-frame data goes through the upload allocator: the views on the RTX path, and the draw commands that the cull pass doesn't generate
+#define UPLOADS (RTX || !CULL_PREPASS)
+
+// Meshlets with a smaller projected diameter (in pixels) are rasterized in a compute shader
+const float kSoftwareRasterThreshold = 16.f;
+
+struct DrawCounts
+{
+	// VkDrawMeshTasksIndirectCommandNV
+	uint32_t taskCount;
+	uint32_t firstTask;
+
+	uint32_t visibleCount;
+
+	// VkDispatchIndirectCommand, one workgroup per software rasterized meshlet
+	uint32_t softwareGroupCountX;
+	uint32_t softwareGroupCountY;
+	uint32_t softwareGroupCountZ;
+};
 
-struct Vertex
+// Side by side in the swapchain image with MULTIVIEW
+#if MULTIVIEW
+const uint32_t kViewCount = 2;
+#else
+const uint32_t kViewCount = 1;
+#endif
+
+struct View
+{
+	float transform[16]; // world to clip, column-major
+	float direction[4]; // world-space viewing direction for cone culling
+	float planes[6][4]; // world-space frustum planes
+};
+
+// Debug counters written by the culling shaders, see CULL_STATS
+struct CullStats
+{
+	uint32_t meshletsTested;
+	uint32_t meshletsConeCulled;
+	uint32_t meshletsFrustumCulled;
+	uint32_t meshletsSoftware;
+	uint32_t trianglesEmitted;
+};
+
+// Statistics are copied to a ring of this many host-visible slots and read back once the slot is this many frames old
+const uint32_t kCullStatsLatency = 3;
+
+struct CullData
 {
-	float vx, vy, vz;
-	float nx, ny, nz;
-	float tu, tv;
+	uint32_t meshletCount;
+	float softwareThreshold;
+	float viewportWidth, viewportHeight;
 };
 
-struct alignas(16) Meshlet
+// Per-device pipeline variant; the first four fields are specialization constants 0-3, the meshlet limits are applied when building meshlets
+struct MeshletConfig
 {
-	float cone[4];
-	uint32_t vertices[64];
-	uint8_t indices[124*3]; // up to 124 triangles
-	uint8_t triangleCount;
-	uint8_t vertexCount;
+	VkBool32 cullPrepass;
+	VkBool32 taskCull;
+	VkBool32 cullStats;
+	uint32_t meshWorkgroupSize;
+	uint32_t cullWorkgroupSize;
+	uint32_t viewCount;
+
+	uint32_t maxVertices;
+	uint32_t maxTriangles;
 };
 
-struct Mesh
+// Frames rendered with every candidate during --autotune; the first kTuneWarmupFrames are not measured
+const int kTuneWarmupFrames = 16;
+const int kTuneFrames = 128;
+
+const char* kTuneFile = "yosemite.tune";
+
+// Pipeline cache kept across runs, so that the pipelines of later runs are found without compiling
+const char* kPipelineCacheFile = "yosemite.cache";
+
+// Pipelines that depend on the meshlet config; autotune compiles one set per candidate in the background
+struct MeshletPipelines
 {
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-	std::vector<Meshlet> meshlets;
+	VkPipeline mesh;
+	VkPipeline vis;
+	VkPipeline cull;
+
+	std::atomic<uint32_t> pending; // the handles may only be read once this is zero
 };
 
+// Per-frame data is written to the frame's upload slot, which is reused once the frame that last wrote it has finished; static command buffers are recorded per slot, so the slot count is a multiple of the cull slot count
+const uint32_t kUploadSlots = 2;
+const VkDeviceSize kUploadSlotSize = 4 * 1024 * 1024;
+
+// Meshes are uploaded in batches of this many meshlets (whole task shader groups), or triangles on the classic path
+const uint32_t kStreamBatchMeshlets = 32 * 64;
+const uint32_t kStreamBatchTriangles = 256 * 1024;
+
 struct Swapchain
 {
 	VkSwapchainKHR swapchain;
@@ -54,8 +167,78 @@ struct Swapchain
 	VkImageView imageViews[8];
 
 	uint32_t width, height;
+
+	VkDeviceSize estimatedSize; // see MemoryTag_Swapchain
+};
+
+struct PresentConfig
+{
+	VkPresentModeKHR presentMode;
+	uint32_t imageCount; // 0 uses the surface minimum
+
+	// Waits for the previous frame to be presented (VK_KHR_present_wait) before sampling input, and reports input-to-present latency
+	bool lowLatency;
+};
+
+// Input times are kept for this many frames in flight between present and present-wait
+const uint32_t kLatencyHistory = 16;
+
+// DYNAMIC_RESOLUTION renders below the swapchain resolution when the GPU frame time exceeds the budget; see updateRenderScale
+struct RenderScale
+{
+	double budget; // seconds of GPU time per frame, 0 keeps the scale fixed
+	double gpuTime; // smoothed, restarts after every scale change
+	float scale; // render extent relative to the swapchain extent, a multiple of kRenderScaleStep
+	int overFrames;
+	int underFrames;
+};
+
+const float kRenderScaleMin = 0.5f;
+const float kRenderScaleMax = 1.0f;
+const float kRenderScaleStep = 1.0f / 16;
+
+// Scaling down reacts quickly to keep the frame rate, scaling up waits until the headroom is stable
+const int kRenderScaleDownFrames = 8;
+const int kRenderScaleUpFrames = 60;
+
+enum MemoryTag
+{
+	MemoryTag_Vertex,
+	MemoryTag_Index,
+	MemoryTag_Meshlet,
+	MemoryTag_Staging,
+	MemoryTag_Cull,
+	MemoryTag_Upload,
+	MemoryTag_RenderTarget,
+	MemoryTag_Swapchain, // estimated from extent and image count, swapchain images are allocated by the presentation engine
+
+	MemoryTag_Count
+};
+
+const char* kMemoryTagNames[MemoryTag_Count] = { "vertex", "index", "meshlet", "staging", "cull", "upload", "rendertarget", "swapchain" };
+
+struct MemoryStats
+{
+	// Tracked by createBuffer/createImage; requested is what the renderer asked for, allocated includes driver alignment padding
+	VkDeviceSize requested[MemoryTag_Count];
+	VkDeviceSize allocated[MemoryTag_Count];
+	uint32_t allocationCount[MemoryTag_Count];
+
+	VkDeviceSize heapAllocated[VK_MAX_MEMORY_HEAPS];
+
+	VkDeviceSize total;
+	VkDeviceSize peak;
+
+	// Refreshed every frame by updateMemoryBudget when VK_EXT_memory_budget is available; usage covers all processes' allocations from this device
+	bool budgetSupported;
+	VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heapPeakUsage[VK_MAX_MEMORY_HEAPS];
 };
 
+// Every device allocation goes through createBuffer/createImage, which keep this up to date
+static MemoryStats gMemoryStats;
+
 struct Buffer
 {
 	VkBuffer buffer;
@@ -63,6 +246,23 @@ struct Buffer
 
 	void* data;
 	size_t size;
+
+	VkMemoryPropertyFlags memoryFlags; // of the chosen memory type, may include preferred flags
+
+	MemoryTag tag;
+	uint32_t heapIndex;
+	VkDeviceSize allocationSize;
+};
+
+struct Image
+{
+	VkImage image;
+	VkImageView imageView;
+	VkDeviceMemory memory;
+
+	MemoryTag tag;
+	uint32_t heapIndex;
+	VkDeviceSize allocationSize;
 };
 
 VkImageMemoryBarrier imageBarrier(VkImage image, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkImageLayout oldLayout, VkImageLayout newLayout)
@@ -96,6 +296,39 @@ VkBufferMemoryBarrier bufferBarrier(VkBuffer buffer, VkAccessFlags srcAccessMask
 	return result;
 }
 
+VkDescriptorSetLayoutBinding descriptorBinding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags stageFlags)
+{
+	VkDescriptorSetLayoutBinding result = {};
+	result.binding = binding;
+	result.descriptorType = type;
+	result.descriptorCount = 1;
+	result.stageFlags = stageFlags;
+
+	return result;
+}
+
+VkWriteDescriptorSet bufferDescriptor(uint32_t binding, const VkDescriptorBufferInfo* bufferInfo)
+{
+	VkWriteDescriptorSet result = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	result.dstBinding = binding;
+	result.descriptorCount = 1;
+	result.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	result.pBufferInfo = bufferInfo;
+
+	return result;
+}
+
+VkWriteDescriptorSet imageDescriptor(uint32_t binding, const VkDescriptorImageInfo* imageInfo)
+{
+	VkWriteDescriptorSet result = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	result.dstBinding = binding;
+	result.descriptorCount = 1;
+	result.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	result.pImageInfo = imageInfo;
+
+	return result;
+}
+
 VkInstance createInstance(void)
 {
 	VK_CHECK(volkInitialize());
@@ -215,24 +448,115 @@ uint32_t getGraphicsQueueFamily(VkPhysicalDevice physicalDevice)
 	return VK_QUEUE_FAMILY_IGNORED;
 }
 
-VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t familyIndex)
+uint32_t getComputeQueueFamily(VkPhysicalDevice physicalDevice, uint32_t graphicsFamily)
+{
+	uint32_t queueCount = 0;
+	VkQueueFamilyProperties queues[64];
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueCount, 0);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueCount, queues);
+
+	// Prefer a dedicated compute family so that compute work can overlap with rendering
+	for (uint32_t i = 0; i < queueCount; i++)
+		if ((queues[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queues[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+			return i;
+
+	// Graphics queues are required to support compute
+	return graphicsFamily;
+}
+
+bool isDeviceExtensionSupported(VkPhysicalDevice physicalDevice, const char* name)
+{
+	uint32_t extensionCount = 0;
+	VK_CHECK(vkEnumerateDeviceExtensionProperties(physicalDevice, 0, &extensionCount, 0));
+
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	VK_CHECK(vkEnumerateDeviceExtensionProperties(physicalDevice, 0, &extensionCount, extensions.data()));
+
+	for (const VkExtensionProperties& extension : extensions)
+		if (strcmp(extension.extensionName, name) == 0)
+			return true;
+
+	return false;
+}
+
+bool isPresentWaitSupported(VkPhysicalDevice physicalDevice)
+{
+	if (!isDeviceExtensionSupported(physicalDevice, VK_KHR_PRESENT_ID_EXTENSION_NAME) || !isDeviceExtensionSupported(physicalDevice, VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+		return false;
+
+	VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR };
+	VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR };
+	presentWaitFeatures.pNext = &presentIdFeatures;
+
+	VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	features.pNext = &presentWaitFeatures;
+
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+	return presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+}
+
+// The culling shaders compact meshlets with subgroup ballots; CULL_STATS reduces its counters with ballots too
+bool isSubgroupBallotSupported(VkPhysicalDevice physicalDevice, VkShaderStageFlags stages)
+{
+	VkPhysicalDeviceSubgroupProperties subgroupProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
+
+	VkPhysicalDeviceProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+	properties.pNext = &subgroupProperties;
+
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+	VkSubgroupFeatureFlags operations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT;
+
+	return (subgroupProperties.supportedOperations & operations) == operations && (subgroupProperties.supportedStages & stages) == stages;
+}
+
+bool isPipelineCacheControlSupported(VkPhysicalDevice physicalDevice)
+{
+	VkPhysicalDeviceVulkan13Features features13 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
+
+	VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	features.pNext = &features13;
+
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+	return features13.pipelineCreationCacheControl;
+}
+
+VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t familyIndex, uint32_t computeFamilyIndex, bool memoryBudget, bool presentWait, bool pipelineCacheControl)
 {
 	float queuePriority = { 1.0f };
 
-	VkDeviceQueueCreateInfo queueInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
-	queueInfo.queueCount = 1;
-	queueInfo.queueFamilyIndex = familyIndex;
-	queueInfo.pQueuePriorities = &queuePriority;
+	VkDeviceQueueCreateInfo queueInfos[2] = {};
+	queueInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueInfos[0].queueCount = 1;
+	queueInfos[0].queueFamilyIndex = familyIndex;
+	queueInfos[0].pQueuePriorities = &queuePriority;
 
-	const char* extensions[] =
+	queueInfos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueInfos[1].queueCount = 1;
+	queueInfos[1].queueFamilyIndex = computeFamilyIndex;
+	queueInfos[1].pQueuePriorities = &queuePriority;
+
+	std::vector<const char*> extensions =
 	{
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 		VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
 		VK_NV_MESH_SHADER_EXTENSION_NAME,
 	};
 
+	if (memoryBudget)
+		extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	if (presentWait)
+	{
+		extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+		extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+	}
+
 	VkPhysicalDeviceVulkan13Features features13 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
 	features13.dynamicRendering = true;
+	features13.pipelineCreationCacheControl = pipelineCacheControl;
 
 #if RTX
 	VkPhysicalDeviceMeshShaderFeaturesNV featuresMesh = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_NV };
@@ -242,22 +566,65 @@ VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t familyIndex)
 	features13.pNext = &featuresMesh;
 #endif
 
-	VkPhysicalDevice8BitStorageFeatures features8 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES };
-	features8.storageBuffer8BitAccess = true;
-	features8.uniformAndStorageBuffer8BitAccess = true;
-	features8.pNext = &features13;
+#if MULTIVIEW
+	VkPhysicalDeviceMultiviewFeatures featuresMultiview = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES };
+	featuresMultiview.multiview = true;
+	featuresMultiview.pNext = features13.pNext;
+
+	features13.pNext = &featuresMultiview;
+#endif
+
+	// 8-bit storage is part of Vulkan 1.2 core and can't be chained separately alongside VkPhysicalDeviceVulkan12Features
+	VkPhysicalDeviceVulkan12Features features12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	features12.storageBuffer8BitAccess = true;
+	features12.uniformAndStorageBuffer8BitAccess = true;
+#if CULL_PREPASS && !RTX
+	features12.drawIndirectCount = true;
+#endif
+#if SWRASTER
+	features12.shaderBufferInt64Atomics = true;
+#endif
+	features12.pNext = &features13;
 
 	VkPhysicalDevice16BitStorageFeatures features16 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES };
 	features16.storageBuffer16BitAccess = true;
 	features16.uniformAndStorageBuffer16BitAccess = true;
-	features16.pNext = &features8;
+	features16.pNext = &features12;
+
+	VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+#if CULL_PREPASS && !RTX
+	// meshletcull.comp stores the meshlet index in firstInstance of the indirect draws
+	features.features.drawIndirectFirstInstance = true;
+#endif
+#if VISBUFFER && !RTX
+	// geometryShader exposes gl_PrimitiveID to fragment shaders on the classic path
+	features.features.geometryShader = true;
+#endif
+#if SWRASTER
+	features.features.shaderInt64 = true;
+	features.features.fragmentStoresAndAtomics = true;
+#endif
+	features.pNext = &features16;
+
+	VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR };
+	presentIdFeatures.presentId = true;
+
+	VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR };
+	presentWaitFeatures.presentWait = true;
+
+	if (presentWait)
+	{
+		presentIdFeatures.pNext = features.pNext;
+		presentWaitFeatures.pNext = &presentIdFeatures;
+		features.pNext = &presentWaitFeatures;
+	}
 
 	VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
-	createInfo.pNext = &features16;
-	createInfo.queueCreateInfoCount = 1;
-	createInfo.pQueueCreateInfos = &queueInfo;
-	createInfo.enabledExtensionCount = ARRAYSIZE(extensions);
-	createInfo.ppEnabledExtensionNames = extensions;
+	createInfo.pNext = &features;
+	createInfo.queueCreateInfoCount = computeFamilyIndex == familyIndex ? 1 : 2;
+	createInfo.pQueueCreateInfos = queueInfos;
+	createInfo.enabledExtensionCount = uint32_t(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
 
 	VkDevice device = 0;
 	VK_CHECK(vkCreateDevice(physicalDevice, &createInfo, 0, &device));
@@ -265,10 +632,10 @@ VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t familyIndex)
 	return device;
 }
 
-VkCommandPool createCommandPool(VkDevice device, uint32_t familyIndex)
+VkCommandPool createCommandPool(VkDevice device, uint32_t familyIndex, VkCommandPoolCreateFlags flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT)
 {
 	VkCommandPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
-	createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	createInfo.flags = flags;
 	createInfo.queueFamilyIndex = familyIndex;
 
 	VkCommandPool pool = 0;
@@ -303,14 +670,14 @@ VkSurfaceFormatKHR getSurfaceFormat(VkPhysicalDevice physicalDevice, VkSurfaceKH
 	return formats[0];
 }
 
-VkImageView createImageView(VkDevice device, VkImage image, VkFormat format)
+VkImageView createImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectMask, uint32_t layerCount = 1)
 {
 	VkImageViewCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
 	createInfo.image = image;
-	createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	createInfo.viewType = layerCount > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
 	createInfo.format = format;
-	createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	createInfo.subresourceRange.layerCount = 1;
+	createInfo.subresourceRange.aspectMask = aspectMask;
+	createInfo.subresourceRange.layerCount = layerCount;
 	createInfo.subresourceRange.levelCount = 1;
 
 	VkImageView view = 0;
@@ -319,147 +686,417 @@ VkImageView createImageView(VkDevice device, VkImage image, VkFormat format)
 	return view;
 }
 
-void createSwapchain(Swapchain& swapchain, VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceFormatKHR format, VkSwapchainKHR old)
+// heapIndex is ~0u for memory that is not allocated through vkAllocateMemory
+void trackAllocation(MemoryTag tag, uint32_t heapIndex, VkDeviceSize requested, VkDeviceSize allocated, uint32_t count = 1)
+{
+	MemoryStats& stats = gMemoryStats;
+
+	stats.requested[tag] += requested;
+	stats.allocated[tag] += allocated;
+	stats.allocationCount[tag] += count;
+
+	if (heapIndex < VK_MAX_MEMORY_HEAPS)
+		stats.heapAllocated[heapIndex] += allocated;
+
+	stats.total += allocated;
+	stats.peak = stats.total > stats.peak ? stats.total : stats.peak;
+}
+
+void trackFree(MemoryTag tag, uint32_t heapIndex, VkDeviceSize requested, VkDeviceSize allocated, uint32_t count = 1)
+{
+	MemoryStats& stats = gMemoryStats;
+
+	assert(stats.allocated[tag] >= allocated && stats.allocationCount[tag] >= count);
+
+	stats.requested[tag] -= requested;
+	stats.allocated[tag] -= allocated;
+	stats.allocationCount[tag] -= count;
+
+	if (heapIndex < VK_MAX_MEMORY_HEAPS)
+		stats.heapAllocated[heapIndex] -= allocated;
+
+	stats.total -= allocated;
+}
+
+void updateMemoryBudget(VkPhysicalDevice physicalDevice)
+{
+	MemoryStats& stats = gMemoryStats;
+
+	if (!stats.budgetSupported)
+		return;
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+
+	VkPhysicalDeviceMemoryProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2 };
+	properties.pNext = &budget;
+
+	vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+
+	static bool warned[VK_MAX_MEMORY_HEAPS] = {};
+
+	for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount; i++)
+	{
+		stats.heapBudget[i] = budget.heapBudget[i];
+		stats.heapUsage[i] = budget.heapUsage[i];
+		stats.heapPeakUsage[i] = budget.heapUsage[i] > stats.heapPeakUsage[i] ? budget.heapUsage[i] : stats.heapPeakUsage[i];
+
+		// Past the budget the driver may start paging; warn once per heap well before that
+		if (!warned[i] && budget.heapUsage[i] > budget.heapBudget[i] / 10 * 9)
+		{
+			printf("Warning: memory heap %d is at %.1f MB of its %.1f MB budget\n", i, double(budget.heapUsage[i]) / (1024 * 1024), double(budget.heapBudget[i]) / (1024 * 1024));
+			warned[i] = true;
+		}
+	}
+}
+
+void dumpMemoryStats(const VkPhysicalDeviceMemoryProperties& memoryProperties)
+{
+	const MemoryStats& stats = gMemoryStats;
+	const double kMB = 1024.0 * 1024.0;
+
+	VkDeviceSize requested = 0;
+	uint32_t allocationCount = 0;
+
+	for (int tag = 0; tag < MemoryTag_Count; tag++)
+	{
+		requested += stats.requested[tag];
+		allocationCount += stats.allocationCount[tag];
+	}
+
+	// Every resource has a dedicated allocation, so the only fragmentation is alignment padding inside each allocation
+	double fragmentation = stats.total ? 1.0 - double(requested) / double(stats.total) : 0.0;
+
+	printf("Memory: %.1f MB in %d allocations, peak %.1f MB, fragmentation %.2f%%\n", stats.total / kMB, allocationCount, stats.peak / kMB, fragmentation * 100);
+
+	for (int tag = 0; tag < MemoryTag_Count; tag++)
+		if (stats.allocationCount[tag])
+			printf("  %-12s %10.2f MB in %d allocations (%.2f MB requested)\n", kMemoryTagNames[tag], stats.allocated[tag] / kMB, stats.allocationCount[tag], stats.requested[tag] / kMB);
+
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+	{
+		const VkMemoryHeap& heap = memoryProperties.memoryHeaps[i];
+
+		printf("  heap %d (%s, %.0f MB): %.1f MB allocated by yosemite", i, (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "device local" : "host", heap.size / kMB, stats.heapAllocated[i] / kMB);
+
+		if (stats.budgetSupported)
+		{
+			double headroom = double(stats.heapBudget[i]) - double(stats.heapUsage[i]);
+
+			printf(", usage %.1f MB of %.1f MB budget, headroom %.1f MB, peak usage %.1f MB", stats.heapUsage[i] / kMB, stats.heapBudget[i] / kMB, headroom / kMB, stats.heapPeakUsage[i] / kMB);
+		}
+
+		printf("\n");
+	}
+
+	if (!stats.budgetSupported)
+		printf("  VK_EXT_memory_budget is not supported, heap usage and budget are unavailable\n");
+}
+
+const char* kPresentModeNames[] = { "immediate", "mailbox", "fifo", "fifo_relaxed" }; // indexed by VkPresentModeKHR
+
+bool parsePresentMode(const char* name, VkPresentModeKHR& presentMode)
+{
+	for (size_t i = 0; i < ARRAYSIZE(kPresentModeNames); i++)
+		if (strcmp(name, kPresentModeNames[i]) == 0)
+		{
+			presentMode = VkPresentModeKHR(i);
+			return true;
+		}
+
+	return false;
+}
+
+// FIFO is the only mode every surface has to support
+VkPresentModeKHR getPresentMode(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkPresentModeKHR requested)
+{
+	uint32_t presentModeCount = 0;
+	VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, 0));
+
+	std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+	VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, presentModes.data()));
+
+	for (VkPresentModeKHR presentMode : presentModes)
+		if (presentMode == requested)
+			return requested;
+
+	printf("Present mode %s is not supported by the surface, falling back to fifo\n", kPresentModeNames[requested]);
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+void createSwapchain(Swapchain& swapchain, VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceFormatKHR format, const PresentConfig& config, VkSwapchainKHR old)
 {
 	VkSurfaceCapabilitiesKHR surfaceCaps;
 	VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCaps));
 
+	// maxImageCount of 0 means there is no limit other than our image array
+	uint32_t imageCount = config.imageCount > surfaceCaps.minImageCount ? config.imageCount : surfaceCaps.minImageCount;
+	uint32_t maxImageCount = surfaceCaps.maxImageCount ? surfaceCaps.maxImageCount : ARRAYSIZE(swapchain.images);
+
+	imageCount = imageCount < maxImageCount ? imageCount : maxImageCount;
+	imageCount = imageCount < ARRAYSIZE(swapchain.images) ? imageCount : ARRAYSIZE(swapchain.images);
+
 	VkSwapchainCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
 	createInfo.surface = surface;
-	createInfo.minImageCount = surfaceCaps.minImageCount;
+	createInfo.minImageCount = imageCount;
 	createInfo.imageFormat = format.format;
 	createInfo.imageColorSpace = format.colorSpace;
 	createInfo.imageExtent = surfaceCaps.currentExtent;
 	createInfo.imageArrayLayers = 1;
-	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	createInfo.preTransform = surfaceCaps.currentTransform;
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	createInfo.presentMode = VSYNC ? VK_PRESENT_MODE_FIFO_KHR : VK_PRESENT_MODE_IMMEDIATE_KHR;
+	createInfo.presentMode = config.presentMode;
 	createInfo.oldSwapchain = old;
 
 	VK_CHECK(vkCreateSwapchainKHR(device, &createInfo, 0, &swapchain.swapchain));
 	assert(swapchain.swapchain);
 
 	VK_CHECK(vkGetSwapchainImagesKHR(device, swapchain.swapchain, &swapchain.imageCount, 0));
+	assert(swapchain.imageCount <= ARRAYSIZE(swapchain.images));
 	VK_CHECK(vkGetSwapchainImagesKHR(device, swapchain.swapchain, &swapchain.imageCount, swapchain.images));
 
 	for (uint32_t i = 0; i < swapchain.imageCount; i++)
 	{
-		swapchain.imageViews[i] = createImageView(device, swapchain.images[i], format.format);
+		swapchain.imageViews[i] = createImageView(device, swapchain.images[i], format.format, VK_IMAGE_ASPECT_COLOR_BIT);
 		assert(swapchain.imageViews[i]);
 	}
 
 	swapchain.width = surfaceCaps.currentExtent.width;
 	swapchain.height = surfaceCaps.currentExtent.height;
+
+	// All swapchain formats we pick are 32 bits per pixel
+	swapchain.estimatedSize = VkDeviceSize(swapchain.width) * swapchain.height * 4 * swapchain.imageCount;
+	trackAllocation(MemoryTag_Swapchain, ~0u, swapchain.estimatedSize, swapchain.estimatedSize, swapchain.imageCount);
 }
 
 void destroySwapchain(VkDevice device, Swapchain& swapchain)
 {
+	trackFree(MemoryTag_Swapchain, ~0u, swapchain.estimatedSize, swapchain.estimatedSize, swapchain.imageCount);
+
 	for (uint32_t i = 0; i < swapchain.imageCount; i++)
 		vkDestroyImageView(device, swapchain.imageViews[i], 0);
 
 	vkDestroySwapchainKHR(device, swapchain.swapchain, 0);
 }
 
-void updateSwapchain(Swapchain& swapchain, VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceFormatKHR format)
+struct RetiredObject
+{
+	uint64_t frame;
+	std::function<void()> destroy;
+};
+
+// Objects that frames in flight (or queued presents) may still reference; each one is destroyed once the frame it was retired in has completed
+struct DeletionQueue
+{
+	std::vector<RetiredObject> objects;
+	uint64_t frameIndex; // frame currently being recorded
+};
+
+// extraFrames keeps the object alive for that many frames after the current one
+void retireObject(DeletionQueue& queue, std::function<void()> destroy, uint32_t extraFrames = 0)
+{
+	RetiredObject object = { queue.frameIndex + extraFrames, std::move(destroy) };
+	queue.objects.push_back(std::move(object));
+}
+
+// Called once the fence of the current frame has been waited on
+void advanceDeletionQueue(DeletionQueue& queue)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < queue.objects.size(); i++)
+	{
+		if (queue.objects[i].frame <= queue.frameIndex)
+			queue.objects[i].destroy();
+		else
+			queue.objects[kept++] = std::move(queue.objects[i]);
+	}
+
+	queue.objects.resize(kept);
+	queue.frameIndex++;
+}
+
+// Destroys everything regardless of frame; the device has to be idle
+void flushDeletionQueue(DeletionQueue& queue)
+{
+	for (RetiredObject& object : queue.objects)
+		object.destroy();
+
+	queue.objects.clear();
+}
+
+// Recreates the swapchain when the surface extent changed, or when force is set because acquire or present reported it out of date or suboptimal
+bool updateSwapchain(Swapchain& swapchain, DeletionQueue& deletionQueue, VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceFormatKHR format, const PresentConfig& config, bool force)
 {
 	VkSurfaceCapabilitiesKHR surfaceCaps = {};
 	VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCaps));
 
 	if (surfaceCaps.currentExtent.width == 0 ||
 		surfaceCaps.currentExtent.height == 0)
-		return;
+		return false;
 
-	if (swapchain.width != surfaceCaps.currentExtent.width ||
+	if (force ||
+		swapchain.width != surfaceCaps.currentExtent.width ||
 		swapchain.height != surfaceCaps.currentExtent.height)
 	{
 		Swapchain old = swapchain;
-		createSwapchain(swapchain, device, physicalDevice, surface, format, old.swapchain);
-		destroySwapchain(device, old);
-		VK_CHECK(vkDeviceWaitIdle(device));
+		createSwapchain(swapchain, device, physicalDevice, surface, format, config, old.swapchain);
+
+		// Presents are processed in order, so once the new swapchain has gone through as many frames as the old one had images, no queued present refers to the old images
+		retireObject(deletionQueue, [device, old]() mutable { destroySwapchain(device, old); }, old.imageCount);
+
+		return true;
 	}
+
+	return false;
 }
 
-VkShaderModule loadShaderModule(VkDevice device, const char* path)
+// Returns true when the scale changed; the caller resizes the render extent (and targets, if needed) before the next frame
+bool updateRenderScale(RenderScale& renderScale, double gpuTime)
 {
-	FILE* file = fopen(path, "rb");
-	assert(file);
-
-	fseek(file, 0, SEEK_END);
-	long length = ftell(file);
-	assert(length >= 0);
-	fseek(file, 0, SEEK_SET);
+	if (renderScale.budget <= 0)
+		return false;
 
-	char* buffer = new char[length];
-	assert(buffer);
+	renderScale.gpuTime = renderScale.gpuTime > 0 ? renderScale.gpuTime * 0.9 + gpuTime * 0.1 : gpuTime;
 
-	size_t rc = fread(buffer, 1, length, file);
-	assert(rc == size_t(length));
-	fclose(file);
+	// One step up increases the pixel count by at most (9/8)^2 = 1.27x, so the upper band stays under budget after scaling up
+	renderScale.overFrames = renderScale.gpuTime > renderScale.budget ? renderScale.overFrames + 1 : 0;
+	renderScale.underFrames = renderScale.gpuTime < renderScale.budget * 0.75 ? renderScale.underFrames + 1 : 0;
 
-	VkShaderModuleCreateInfo createInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-	createInfo.pCode = (uint32_t*)buffer;
-	createInfo.codeSize = size_t(length);
+	float scale = renderScale.scale;
 
-	VkShaderModule shaderModule = 0;
-	VK_CHECK(vkCreateShaderModule(device, &createInfo, 0, &shaderModule));
+	if (renderScale.overFrames >= kRenderScaleDownFrames)
+	{
+		// GPU time is roughly proportional to the pixel count, i.e. to the scale squared; rounding down drops at least one step
+		float target = scale * sqrtf(float(renderScale.budget / renderScale.gpuTime));
+		scale = floorf(target / kRenderScaleStep) * kRenderScaleStep;
 
-	delete[] buffer;
+		renderScale.overFrames = 0;
+	}
+	else if (renderScale.underFrames >= kRenderScaleUpFrames)
+	{
+		scale += kRenderScaleStep;
 
-	return shaderModule;
-}
+		renderScale.underFrames = 0;
+	}
 
-VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device)
-{
-#if RTX
-	VkDescriptorSetLayoutBinding bindings[2] = {};
-	bindings[0].binding = 0;
-	bindings[0].descriptorCount = 1;
-	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	bindings[0].stageFlags = VK_SHADER_STAGE_MESH_BIT_NV | VK_SHADER_STAGE_TASK_BIT_NV;
-	
-	bindings[1].binding = 1;
-	bindings[1].descriptorCount = 1;
-	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	bindings[1].stageFlags = VK_SHADER_STAGE_MESH_BIT_NV | VK_SHADER_STAGE_TASK_BIT_NV;
-#else
-	VkDescriptorSetLayoutBinding bindings[1] = {};
-	bindings[0].binding = 0;
-	bindings[0].descriptorCount = 1;
-	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-#endif
+	scale = scale < kRenderScaleMin ? kRenderScaleMin : scale;
+	scale = scale > kRenderScaleMax ? kRenderScaleMax : scale;
 
-	VkDescriptorSetLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-	createInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
-	createInfo.bindingCount = ARRAYSIZE(bindings);
-	createInfo.pBindings = bindings;
+	if (scale == renderScale.scale)
+		return false;
 
-	VkDescriptorSetLayout setLayout = 0;
-	VK_CHECK(vkCreateDescriptorSetLayout(device, &createInfo, 0, &setLayout));
+	renderScale.scale = scale;
+	renderScale.gpuTime = 0;
 
-	return setLayout;
+	return true;
 }
 
-VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout)
+// Orthographic camera matching the fixed transform of the single view path (y flipped, z mapped to [0, 1] at half scale), turned around the Y axis
+void buildView(View& view, float yaw)
 {
-	VkPipelineLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-	createInfo.setLayoutCount = 1;
-	createInfo.pSetLayouts = &setLayout;
+	float c = cosf(yaw), s = sinf(yaw);
 
-	VkPipelineLayout layout = 0;
-	VK_CHECK(vkCreatePipelineLayout(device, &createInfo, 0, &layout));
+	float rows[4][4] =
+	{
+		{ c, 0, s, 0 },
+		{ 0, -1, 0, 0 },
+		{ -s * 0.5f, 0, c * 0.5f, 0.5f },
+		{ 0, 0, 0, 1 },
+	};
 
-	return layout;
-}
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			view.transform[j * 4 + i] = rows[i][j];
 
-VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout, const VkPipelineRenderingCreateInfo* renderingInfo, const std::vector<VkShaderModule>& shaderModules, const std::vector<VkShaderStageFlags> stageFlags)
+	// The single view path culls cones against -Z; rotate that into world space
+	view.direction[0] = s;
+	view.direction[1] = 0;
+	view.direction[2] = -c;
+	view.direction[3] = 0;
+
+	// Clip volume is -w <= x, y <= w and 0 <= z <= w; each plane combines two matrix rows (Gribb/Hartmann)
+	const int kPlaneRows[6][2] = { { 3, 0 }, { 3, 0 }, { 3, 1 }, { 3, 1 }, { 2, 2 }, { 3, 2 } };
+	const float kPlaneSigns[6][2] = { { 1, 1 }, { 1, -1 }, { 1, 1 }, { 1, -1 }, { 0, 1 }, { 1, -1 } };
+
+	for (int p = 0; p < 6; ++p)
+	{
+		float plane[4];
+
+		for (int j = 0; j < 4; ++j)
+			plane[j] = kPlaneSigns[p][0] * rows[kPlaneRows[p][0]][j] + kPlaneSigns[p][1] * rows[kPlaneRows[p][1]][j];
+
+		float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+
+		for (int j = 0; j < 4; ++j)
+			view.planes[p][j] = plane[j] / length;
+	}
+}
+
+VkShaderModule loadShaderModule(VkDevice device, ShaderRegistry& registry, const char* name)
+{
+	const ShaderFile* file = findShader(registry, name);
+
+	if (!file)
+	{
+		printf("Shader %s.spv not found\n", name);
+		return 0;
+	}
+
+	// The code is read from the file mapping, which the registry keeps alive
+	VkShaderModuleCreateInfo createInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+	createInfo.pCode = file->code;
+	createInfo.codeSize = file->size;
+
+	VkShaderModule shaderModule = 0;
+	VK_CHECK(vkCreateShaderModule(device, &createInfo, 0, &shaderModule));
+
+	return shaderModule;
+}
+
+VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device, const VkDescriptorSetLayoutBinding* bindings, uint32_t bindingCount)
+{
+	VkDescriptorSetLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	createInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+	createInfo.bindingCount = bindingCount;
+	createInfo.pBindings = bindings;
+
+	VkDescriptorSetLayout setLayout = 0;
+	VK_CHECK(vkCreateDescriptorSetLayout(device, &createInfo, 0, &setLayout));
+
+	return setLayout;
+}
+
+VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout, VkShaderStageFlags pushConstantStages, uint32_t pushConstantSize)
+{
+	VkPipelineLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	createInfo.setLayoutCount = 1;
+	createInfo.pSetLayouts = &setLayout;
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = pushConstantStages;
+	pushConstantRange.size = pushConstantSize;
+
+	if (pushConstantSize)
+	{
+		createInfo.pushConstantRangeCount = 1;
+		createInfo.pPushConstantRanges = &pushConstantRange;
+	}
+
+	VkPipelineLayout layout = 0;
+	VK_CHECK(vkCreatePipelineLayout(device, &createInfo, 0, &layout));
+
+	return layout;
+}
+
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout, const VkPipelineRenderingCreateInfo* renderingInfo, const std::vector<VkShaderModule>& shaderModules, const std::vector<VkShaderStageFlags> stageFlags, const VkSpecializationInfo* specializationInfo, const VkPipelineVertexInputStateCreateInfo* vertexInputState = 0, VkPipelineCreateFlags flags = 0)
 {
 	assert(shaderModules.size());
 	assert(shaderModules.size() == stageFlags.size());
 
 	VkGraphicsPipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
 	createInfo.pNext = renderingInfo;
+	createInfo.flags = flags;
 	createInfo.layout = layout;
 
 	VkPipelineShaderStageCreateInfo stages[8] = {};
@@ -469,13 +1106,15 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache cache, VkPipe
 		stages[i].module = shaderModules[i];
 		stages[i].pName = "main";
 		stages[i].stage = (VkShaderStageFlagBits)stageFlags[i];
+		stages[i].pSpecializationInfo = specializationInfo;
 	}
 
 	createInfo.stageCount = uint32_t(shaderModules.size());
 	createInfo.pStages = stages;
 
-	VkPipelineVertexInputStateCreateInfo vertexInputState = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
-	createInfo.pVertexInputState = &vertexInputState;
+	// Shaders pull vertex data from storage buffers unless the caller provides vertex input state
+	VkPipelineVertexInputStateCreateInfo emptyVertexInputState = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+	createInfo.pVertexInputState = vertexInputState ? vertexInputState : &emptyVertexInputState;
 
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
 	inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
@@ -500,11 +1139,20 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache cache, VkPipe
 	VkPipelineDepthStencilStateCreateInfo depthStencilState = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
 	createInfo.pDepthStencilState = &depthStencilState;
 
-	VkPipelineColorBlendAttachmentState attachments[1] = {};
-	attachments[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	// The camera looks down -Z, so closer fragments have greater depth
+	if (renderingInfo->depthAttachmentFormat != VK_FORMAT_UNDEFINED)
+	{
+		depthStencilState.depthTestEnable = true;
+		depthStencilState.depthWriteEnable = true;
+		depthStencilState.depthCompareOp = VK_COMPARE_OP_GREATER;
+	}
+
+	VkPipelineColorBlendAttachmentState attachments[8] = {};
+	for (uint32_t i = 0; i < renderingInfo->colorAttachmentCount; i++)
+		attachments[i].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 
 	VkPipelineColorBlendStateCreateInfo colorBlendState = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
-	colorBlendState.attachmentCount = ARRAYSIZE(attachments);
+	colorBlendState.attachmentCount = renderingInfo->colorAttachmentCount;
 	colorBlendState.pAttachments = attachments;
 	createInfo.pColorBlendState = &colorBlendState;
 
@@ -519,14 +1167,212 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache cache, VkPipe
 	dynamicState.pDynamicStates = dynamicStates;
 	createInfo.pDynamicState = &dynamicState;
 
+	// With VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT, pipelines missing from the cache are reported instead of compiled
+	VkPipeline pipeline = 0;
+	VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &createInfo, 0, &pipeline);
+
+	if (result == VK_PIPELINE_COMPILE_REQUIRED)
+		return VK_NULL_HANDLE;
+
+	VK_CHECK(result);
+
+	return pipeline;
+}
+
+VkPipeline createComputePipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout, VkShaderModule shaderModule, const VkSpecializationInfo* specializationInfo, VkPipelineCreateFlags flags = 0)
+{
+	VkComputePipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	createInfo.flags = flags;
+	createInfo.layout = layout;
+
+	createInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	createInfo.stage.module = shaderModule;
+	createInfo.stage.pName = "main";
+	createInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	createInfo.stage.pSpecializationInfo = specializationInfo;
+
 	VkPipeline pipeline = 0;
-	VK_CHECK(vkCreateGraphicsPipelines(device, cache, 1, &createInfo, 0, &pipeline));
+	VkResult result = vkCreateComputePipelines(device, cache, 1, &createInfo, 0, &pipeline);
+
+	if (result == VK_PIPELINE_COMPILE_REQUIRED)
+		return VK_NULL_HANDLE;
+
+	VK_CHECK(result);
 
 	return pipeline;
 }
 
-uint32_t chooseMemoryType(const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t memoryTypeBits, VkMemoryPropertyFlags flags)
+VkPipelineCache createPipelineCache(VkDevice device, const char* path)
+{
+	size_t size = 0;
+	const void* data = mapFile(path, size);
+
+	// The driver checks the header and starts with an empty cache if the data comes from another device or driver version
+	VkPipelineCacheCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	createInfo.initialDataSize = data ? size : 0;
+	createInfo.pInitialData = data;
+
+	VkPipelineCache cache = 0;
+	VK_CHECK(vkCreatePipelineCache(device, &createInfo, 0, &cache));
+
+	if (data)
+		unmapFile(data, size);
+
+	return cache;
+}
+
+void savePipelineCache(VkDevice device, VkPipelineCache cache, const char* path)
+{
+	size_t size = 0;
+	VK_CHECK(vkGetPipelineCacheData(device, cache, &size, 0));
+
+	std::vector<char> data(size);
+	VK_CHECK(vkGetPipelineCacheData(device, cache, &size, data.data()));
+
+	FILE* file = fopen(path, "wb");
+
+	if (!file)
+	{
+		printf("Failed to write %s\n", path);
+		return;
+	}
+
+	fwrite(data.data(), 1, size, file);
+	fclose(file);
+}
+
+// Compiles pipelines on worker threads; with pipelineCreationCacheControl, pipelines found in the cache are created right away on the requesting thread
+struct PipelineCompiler
+{
+	VkDevice device;
+	bool cacheProbe;
+
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable wake; // workers: a job was queued
+	std::condition_variable done; // waitPipelines: a pending count was decremented
+	std::deque<std::function<void()>> jobs; // in request order
+	bool quit;
+
+	std::atomic<uint32_t> cacheHits;
+	std::atomic<uint32_t> compileCount;
+};
+
+// Runs the oldest queued job; returns false if there was none (or the compiler is shutting down)
+bool runPipelineJob(PipelineCompiler& compiler, bool wait)
+{
+	std::function<void()> job;
+
+	{
+		std::unique_lock<std::mutex> lock(compiler.mutex);
+
+		if (wait)
+			compiler.wake.wait(lock, [&]() { return compiler.quit || !compiler.jobs.empty(); });
+
+		if (compiler.quit || compiler.jobs.empty())
+			return false;
+
+		job = std::move(compiler.jobs.front());
+		compiler.jobs.pop_front();
+	}
+
+	job();
+
+	return true;
+}
+
+void createPipelineCompiler(PipelineCompiler& compiler, VkDevice device, bool cacheProbe, unsigned int threadCount)
+{
+	compiler.device = device;
+	compiler.cacheProbe = cacheProbe;
+	compiler.quit = false;
+	compiler.cacheHits = 0;
+	compiler.compileCount = 0;
+
+	for (unsigned int i = 0; i < threadCount; ++i)
+		compiler.threads.emplace_back([&compiler]() { while (runPipelineJob(compiler, true)) {} });
+}
+
+// Jobs that haven't started are dropped; their pending counts never reach zero
+void destroyPipelineCompiler(PipelineCompiler& compiler)
+{
+	{
+		std::lock_guard<std::mutex> lock(compiler.mutex);
+		compiler.quit = true;
+	}
+
+	compiler.wake.notify_all();
+
+	for (std::thread& thread : compiler.threads)
+		thread.join();
+
+	compiler.threads.clear();
+	compiler.jobs.clear();
+}
+
+// create is called with the flags to use; the result is written before pending is decremented, on this thread for cache hits and on a worker otherwise
+void requestPipeline(PipelineCompiler& compiler, VkPipeline& result, std::atomic<uint32_t>& pending, const std::function<VkPipeline(VkPipelineCreateFlags)>& create)
+{
+	pending.fetch_add(1);
+
+	if (compiler.cacheProbe)
+	{
+		VkPipeline pipeline = create(VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT);
+
+		if (pipeline)
+		{
+			compiler.cacheHits++;
+
+			result = pipeline;
+			pending.fetch_sub(1, std::memory_order_release);
+			return;
+		}
+	}
+
+	std::function<void()> job = [&compiler, &result, &pending, create]()
+	{
+		result = create(0);
+		assert(result);
+
+		compiler.compileCount++;
+
+		// Decrementing under the lock means a waiter either sees the new count or is already asleep and gets the notification
+		{
+			std::lock_guard<std::mutex> lock(compiler.mutex);
+			pending.fetch_sub(1, std::memory_order_release);
+		}
+
+		compiler.done.notify_all();
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(compiler.mutex);
+		compiler.jobs.push_back(std::move(job));
+	}
+
+	compiler.wake.notify_one();
+}
+
+// Helps with queued jobs, then sleeps until the workers finish the pending pipelines; jobs are only queued by the thread that waits
+void waitPipelines(PipelineCompiler& compiler, const std::atomic<uint32_t>& pending)
+{
+	while (pending.load(std::memory_order_acquire))
+		if (!runPipelineJob(compiler, false))
+		{
+			std::unique_lock<std::mutex> lock(compiler.mutex);
+			compiler.done.wait(lock, [&]() { return pending.load(std::memory_order_acquire) == 0; });
+		}
+}
+
+// preferredFlags are tried first and dropped if no compatible type has them, e.g. device local host visible memory is only exposed with resizable BAR
+uint32_t chooseMemoryType(const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t memoryTypeBits, VkMemoryPropertyFlags flags, VkMemoryPropertyFlags preferredFlags = 0)
 {
+	if (preferredFlags)
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+			if ((memoryTypeBits & (1 << i)) && ((memoryProperties.memoryTypes[i].propertyFlags & (flags | preferredFlags)) == (flags | preferredFlags)))
+				return i;
+
 	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
 		if ((memoryTypeBits & (1 << i)) && ((memoryProperties.memoryTypes[i].propertyFlags & flags) == flags))
 			return i;
@@ -535,12 +1381,20 @@ uint32_t chooseMemoryType(const VkPhysicalDeviceMemoryProperties& memoryProperti
 	return ~0u;
 }
 
-void createBuffer(Buffer& buffer, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags)
+void createBuffer(Buffer& buffer, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags, MemoryTag tag, const std::vector<uint32_t>& queueFamilies = {}, VkMemoryPropertyFlags preferredFlags = 0)
 {
 	VkBufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
 	createInfo.size = size;
 	createInfo.usage = usage;
 
+	// Buffers accessed from several queue families are shared concurrently to avoid ownership transfers
+	if (queueFamilies.size() > 1 && queueFamilies[0] != queueFamilies[1])
+	{
+		createInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		createInfo.queueFamilyIndexCount = uint32_t(queueFamilies.size());
+		createInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
+
 	VK_CHECK(vkCreateBuffer(device, &createInfo, 0, &buffer.buffer));
 	assert(buffer.buffer);
 
@@ -548,8 +1402,8 @@ void createBuffer(Buffer& buffer, VkDevice device, const VkPhysicalDeviceMemoryP
 	vkGetBufferMemoryRequirements(device, buffer.buffer, &memoryRequirements);
 
 	VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-	allocateInfo.allocationSize = size;
-	allocateInfo.memoryTypeIndex = chooseMemoryType(memoryProperties, memoryRequirements.memoryTypeBits, memoryFlags);
+	allocateInfo.allocationSize = memoryRequirements.size;
+	allocateInfo.memoryTypeIndex = chooseMemoryType(memoryProperties, memoryRequirements.memoryTypeBits, memoryFlags, preferredFlags);
 
 	VK_CHECK(vkAllocateMemory(device, &allocateInfo, 0, &buffer.memory));
 	VK_CHECK(vkBindBufferMemory(device, buffer.buffer, buffer.memory, 0));
@@ -558,6 +1412,59 @@ void createBuffer(Buffer& buffer, VkDevice device, const VkPhysicalDeviceMemoryP
 		VK_CHECK(vkMapMemory(device, buffer.memory, 0, size, 0, &buffer.data));
 
 	buffer.size = size;
+	buffer.memoryFlags = memoryProperties.memoryTypes[allocateInfo.memoryTypeIndex].propertyFlags;
+
+	buffer.tag = tag;
+	buffer.heapIndex = memoryProperties.memoryTypes[allocateInfo.memoryTypeIndex].heapIndex;
+	buffer.allocationSize = allocateInfo.allocationSize;
+
+	trackAllocation(tag, buffer.heapIndex, size, buffer.allocationSize);
+}
+
+void createImage(Image& image, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspectMask, MemoryTag tag, uint32_t layerCount = 1)
+{
+	VkImageCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	createInfo.imageType = VK_IMAGE_TYPE_2D;
+	createInfo.format = format;
+	createInfo.extent = { width, height, 1 };
+	createInfo.mipLevels = 1;
+	createInfo.arrayLayers = layerCount;
+	createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	createInfo.usage = usage;
+	createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VK_CHECK(vkCreateImage(device, &createInfo, 0, &image.image));
+	assert(image.image);
+
+	VkMemoryRequirements memoryRequirements = {};
+	vkGetImageMemoryRequirements(device, image.image, &memoryRequirements);
+
+	VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocateInfo.allocationSize = memoryRequirements.size;
+	allocateInfo.memoryTypeIndex = chooseMemoryType(memoryProperties, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	VK_CHECK(vkAllocateMemory(device, &allocateInfo, 0, &image.memory));
+	VK_CHECK(vkBindImageMemory(device, image.image, image.memory, 0));
+
+	image.imageView = createImageView(device, image.image, format, aspectMask, layerCount);
+	assert(image.imageView);
+
+	image.tag = tag;
+	image.heapIndex = memoryProperties.memoryTypes[allocateInfo.memoryTypeIndex].heapIndex;
+	image.allocationSize = allocateInfo.allocationSize;
+
+	// Image layout is opaque, so the whole allocation counts as requested
+	trackAllocation(tag, image.heapIndex, image.allocationSize, image.allocationSize);
+}
+
+void destroyImage(VkDevice device, Image& image)
+{
+	trackFree(image.tag, image.heapIndex, image.allocationSize, image.allocationSize);
+
+	vkDestroyImageView(device, image.imageView, 0);
+	vkDestroyImage(device, image.image, 0);
+	vkFreeMemory(device, image.memory, 0);
 }
 
 void uploadBuffer(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkCommandBuffer commandBuffer, const Buffer& src, const Buffer& dst, size_t size)
@@ -585,254 +1492,763 @@ void uploadBuffer(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkC
 
 void destroyBuffer(VkDevice device, Buffer& buffer)
 {
+	trackFree(buffer.tag, buffer.heapIndex, buffer.size, buffer.allocationSize);
+
 	vkFreeMemory(device, buffer.memory, 0);
 	vkDestroyBuffer(device, buffer.buffer, 0);
 }
 
-VkSemaphore createSemaphore(VkDevice device)
+// Uploads one batch at a time through the staging buffer; frames draw the ranges of the last batch whose fence has signaled while the next one copies
+struct MeshStream
 {
-	VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
-
-	VkSemaphore semaphore = 0;
-	VK_CHECK(vkCreateSemaphore(device, &createInfo, 0, &semaphore));
-
-	return semaphore;
-}
+	VkCommandPool commandPool;
+	VkCommandBuffer commandBuffer;
+	VkFence fence;
+	bool pending;
+
+	// Prefixes of Mesh::meshlets, Mesh::indices and the vertex streams submitted so far
+	uint32_t meshletCount;
+	uint32_t indexCount;
+	uint32_t vertexCount;
+
+	// Prefixes the GPU has finished copying
+	uint32_t readyMeshlets;
+	uint32_t readyIndices;
+};
 
-void loadObj(std::vector<Vertex>& vertices, const char* path)
+void createMeshStream(MeshStream& stream, VkDevice device, uint32_t familyIndex)
 {
-	fastObjMesh* obj = fast_obj_read(path);
-	assert(obj);
+	stream.commandPool = createCommandPool(device, familyIndex);
+	assert(stream.commandPool);
 
-	size_t index_count = 0;
-
-	for (uint32_t i = 0; i < obj->face_count; i++)
-		index_count += 3 * (obj->face_vertices[i] - 2);
+	VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	allocateInfo.commandBufferCount = 1;
+	allocateInfo.commandPool = stream.commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 
-	vertices.resize(index_count);
+	VK_CHECK(vkAllocateCommandBuffers(device, &allocateInfo, &stream.commandBuffer));
 
-	size_t vertex_offset = 0;
-	size_t index_offset = 0;
+	stream.fence = createFence(device);
+	assert(stream.fence);
+}
 
-	for (uint32_t i = 0; i < obj->face_count; i++)
-	{
-		for (uint32_t j = 0; j < obj->face_vertices[i]; j++)
-		{
-			fastObjIndex gi = obj->indices[index_offset + j];
+void destroyMeshStream(VkDevice device, MeshStream& stream)
+{
+	vkDestroyFence(device, stream.fence, 0);
+	vkDestroyCommandPool(device, stream.commandPool, 0);
+}
 
-			if (j >= 3)
-			{
-				vertices[vertex_offset + 0] = vertices[vertex_offset - 3];
-				vertices[vertex_offset + 1] = vertices[vertex_offset - 1];
-				vertex_offset += 2;
-			}
+// Only meaningful once the mesh has been loaded
+bool isMeshResident(const MeshStream& stream, const Mesh& mesh)
+{
+	return !stream.pending && stream.meshletCount == mesh.meshlets.size() && stream.indexCount == mesh.indices.size() && stream.vertexCount == mesh.positions.size();
+}
 
-			Vertex& v = vertices[vertex_offset++];
+void streamRange(VkCommandBuffer commandBuffer, const Buffer& scratch, size_t& scratchOffset, const Buffer& dst, const void* data, size_t elementSize, size_t begin, size_t end)
+{
+	if (begin == end)
+		return;
 
-			v.vx = obj->positions[gi.p * 3 + 0];
-			v.vy = obj->positions[gi.p * 3 + 1];
-			v.vz = obj->positions[gi.p * 3 + 2];
+	size_t size = (end - begin) * elementSize;
 
-			v.nx = obj->normals[gi.n * 3 + 0];
-			v.ny = obj->normals[gi.n * 3 + 1];
-			v.nz = obj->normals[gi.n * 3 + 2];
-			
-			v.tu = obj->texcoords[gi.t * 2 + 0];
-			v.tv = obj->texcoords[gi.t * 2 + 1];
-		}
+	assert(scratchOffset + size <= scratch.size);
+	assert(end * elementSize <= dst.size);
 
-		index_offset += obj->face_vertices[i];
-	}
+	memcpy(static_cast<char*>(scratch.data) + scratchOffset, static_cast<const char*>(data) + begin * elementSize, size);
 
-	assert(vertex_offset == index_offset);
+	VkBufferCopy region = { scratchOffset, begin * elementSize, size };
+	vkCmdCopyBuffer(commandBuffer, scratch.buffer, dst.buffer, 1, &region);
 
-	fast_obj_destroy(obj);
+	scratchOffset = (scratchOffset + size + 15) & ~size_t(15);
 }
 
-void loadMesh(Mesh& mesh, const char* path, bool buildMeshlets)
+// Publishes the pending batch once its fence has signaled and submits the next one; returns true when the ready ranges grew
+bool updateMeshStream(MeshStream& stream, VkDevice device, VkQueue queue, const Mesh& mesh, VkIndexType indexType, const Buffer& scratch, const Buffer& vb, const Buffer& ab, const Buffer& ib, const Buffer* mb)
 {
-	std::vector<Vertex> triangle_vertices;
-	loadObj(triangle_vertices, path);
+	bool published = false;
+
+	if (stream.pending)
+	{
+		if (vkGetFenceStatus(device, stream.fence) != VK_SUCCESS)
+			return false;
 
-	size_t index_count = triangle_vertices.size();
+		VK_CHECK(vkResetFences(device, 1, &stream.fence));
 
-	std::vector<uint32_t> remap(index_count);
-	size_t vertex_count = meshopt_generateVertexRemap(remap.data(), 0, index_count, triangle_vertices.data(), index_count, sizeof(Vertex));
+		stream.pending = false;
+		stream.readyMeshlets = stream.meshletCount;
+		stream.readyIndices = stream.indexCount;
 
-	mesh.vertices.resize(vertex_count);
-	mesh.indices.resize(index_count);
+		published = true;
+	}
 
-	meshopt_remapVertexBuffer(mesh.vertices.data(), triangle_vertices.data(), index_count, sizeof(Vertex), remap.data());
-	meshopt_remapIndexBuffer(mesh.indices.data(), 0, index_count, remap.data());
+	if (isMeshResident(stream, mesh))
+		return published;
 
-	meshopt_optimizeVertexCache(mesh.indices.data(), mesh.indices.data(), index_count, vertex_count);
-	meshopt_optimizeVertexFetch(mesh.vertices.data(), mesh.indices.data(), index_count, mesh.vertices.data(), vertex_count, sizeof(Vertex));
+	uint32_t meshletEnd = stream.meshletCount;
+	uint32_t indexEnd = stream.indexCount;
+	uint32_t vertexEnd = stream.vertexCount;
 
-	if (buildMeshlets)
+	// Batches cover the indices and vertices their meshlets (or triangles) reference; after optimizeMeshletOrder these are mostly contiguous
+	if (!mesh.meshlets.empty())
 	{
-		Meshlet meshlet = {};
-		std::vector<uint8_t> meshletVertices(mesh.vertices.size(), 0xff);
+		meshletEnd = meshletEnd + kStreamBatchMeshlets < mesh.meshlets.size() ? meshletEnd + kStreamBatchMeshlets : uint32_t(mesh.meshlets.size());
 
-		for (uint32_t i = 0; i < mesh.indices.size(); i += 3)
+		for (uint32_t i = stream.meshletCount; i < meshletEnd; ++i)
 		{
-			uint32_t a = mesh.indices[i + 0];
-			uint32_t b = mesh.indices[i + 1];
-			uint32_t c = mesh.indices[i + 2];
+			const Meshlet& meshlet = mesh.meshlets[i];
 
-			uint8_t& av = meshletVertices[a];
-			uint8_t& bv = meshletVertices[b];
-			uint8_t& cv = meshletVertices[c];
+			for (uint32_t j = 0; j < meshlet.vertexCount; ++j)
+				vertexEnd = meshlet.vertices[j] >= vertexEnd ? meshlet.vertices[j] + 1 : vertexEnd;
 
-			if (meshlet.vertexCount + (av == 0xff) + (bv == 0xff) + (cv == 0xff) > 64 || meshlet.triangleCount >= 124)
-			{
-				mesh.meshlets.push_back(meshlet);
-
-				for (size_t j = 0; j < meshlet.vertexCount; j++)
-					meshletVertices[meshlet.vertices[j]] = 0xff;
+			uint32_t meshletIndexEnd = meshlet.indexOffset + meshlet.triangleCount * 3;
+			indexEnd = meshletIndexEnd > indexEnd ? meshletIndexEnd : indexEnd;
+		}
+	}
+	else
+	{
+		indexEnd = indexEnd + kStreamBatchTriangles * 3 < mesh.indices.size() ? indexEnd + kStreamBatchTriangles * 3 : uint32_t(mesh.indices.size());
 
-				meshlet = {};
-			}
+		for (uint32_t i = stream.indexCount; i < indexEnd; ++i)
+			vertexEnd = mesh.indices[i] >= vertexEnd ? mesh.indices[i] + 1 : vertexEnd;
+	}
 
-			if (av == 0xff)
-			{
-				av = meshlet.vertexCount;
-				meshlet.vertices[meshlet.vertexCount++] = a;
-			}
+	// The last batch also takes whatever nothing has referenced so far
+	if (mesh.meshlets.empty() ? indexEnd == mesh.indices.size() : meshletEnd == mesh.meshlets.size())
+	{
+		indexEnd = uint32_t(mesh.indices.size());
+		vertexEnd = uint32_t(mesh.positions.size());
+	}
 
-			if (bv == 0xff)
-			{
-				bv = meshlet.vertexCount;
-				meshlet.vertices[meshlet.vertexCount++] = b;
-			}
+	VK_CHECK(vkResetCommandPool(device, stream.commandPool, 0));
 
-			if (cv == 0xff)
-			{
-				cv = meshlet.vertexCount;
-				meshlet.vertices[meshlet.vertexCount++] = c;
-			}
+	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-			meshlet.indices[meshlet.triangleCount * 3 + 0] = av;
-			meshlet.indices[meshlet.triangleCount * 3 + 1] = bv;
-			meshlet.indices[meshlet.triangleCount * 3 + 2] = cv;
-			meshlet.triangleCount++;
-		}
+	VK_CHECK(vkBeginCommandBuffer(stream.commandBuffer, &beginInfo));
 
-		if (meshlet.triangleCount)
-			mesh.meshlets.push_back(meshlet);
+	// The previous batch has completed, so the staging buffer is free
+	size_t scratchOffset = 0;
 
-		while (mesh.meshlets.size() % 32)
-			mesh.meshlets.push_back(Meshlet());
+	if (mb)
+		streamRange(stream.commandBuffer, scratch, scratchOffset, *mb, mesh.meshlets.data(), sizeof(Meshlet), stream.meshletCount, meshletEnd);
 
-		// Build meshlet cones
-		for (Meshlet& meshlet : mesh.meshlets)
-		{
-			float normals[126][3] = {};
+	streamRange(stream.commandBuffer, scratch, scratchOffset, vb, mesh.positions.data(), sizeof(VertexPosition), stream.vertexCount, vertexEnd);
+	streamRange(stream.commandBuffer, scratch, scratchOffset, ab, mesh.attributes.data(), sizeof(VertexAttributes), stream.vertexCount, vertexEnd);
 
-			for (unsigned int i = 0; i < meshlet.triangleCount; ++i)
-			{
-				unsigned int a = meshlet.indices[i * 3 + 0];
-				unsigned int b = meshlet.indices[i * 3 + 1];
-				unsigned int c = meshlet.indices[i * 3 + 2];
+	if (indexType == VK_INDEX_TYPE_UINT16)
+		streamRange(stream.commandBuffer, scratch, scratchOffset, ib, mesh.indices16.data(), sizeof(uint16_t), stream.indexCount, indexEnd);
+	else
+		streamRange(stream.commandBuffer, scratch, scratchOffset, ib, mesh.indices.data(), sizeof(uint32_t), stream.indexCount, indexEnd);
 
-				const Vertex& va = mesh.vertices[meshlet.vertices[a]];
-				const Vertex& vb = mesh.vertices[meshlet.vertices[b]];
-				const Vertex& vc = mesh.vertices[meshlet.vertices[c]];
+	// Frames that draw the batch are submitted after its fence has been observed, this makes the copies visible to them
+	VkMemoryBarrier copyBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	copyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	copyBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
 
-				float p0[3] = { va.vx, va.vy, va.vz };
-				float p1[3] = { vb.vx, vb.vy, vb.vz };
-				float p2[3] = { vc.vx, vc.vy, vc.vz };
+	vkCmdPipelineBarrier(stream.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &copyBarrier, 0, 0, 0, 0);
 
-				float p10[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
-				float p20[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	VK_CHECK(vkEndCommandBuffer(stream.commandBuffer));
 
-				float normalx = p10[1] * p20[2] - p10[2] * p20[1];
-				float normaly = p10[2] * p20[0] - p10[0] * p20[2];
-				float normalz = p10[0] * p20[1] - p10[1] * p20[0];
+	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &stream.commandBuffer;
+	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, stream.fence));
 
-				float area = sqrtf(normalx * normalx + normaly * normaly + normalz * normalz);
-				float invarea = area == 0.f ? 0.f : 1 / area;
+	stream.pending = true;
+	stream.meshletCount = meshletEnd;
+	stream.indexCount = indexEnd;
+	stream.vertexCount = vertexEnd;
 
-				normals[i][0] = normalx * invarea;
-				normals[i][1] = normaly * invarea;
-				normals[i][2] = normalz * invarea;
-			}
+	return published;
+}
 
-			float avgnormal[3] = {};
+// Persistently mapped buffer split into one region per frame slot; per-frame data is bump allocated from the current slot, which is reset at the start of the frame that reuses it
+struct UploadAllocator
+{
+	Buffer buffer;
 
-			for (unsigned int i = 0; i < meshlet.triangleCount; ++i)
-			{
-				avgnormal[0] += normals[i][0];
-				avgnormal[1] += normals[i][1];
-				avgnormal[2] += normals[i][2];
-			}
+	VkDeviceSize slotSize;
+	uint32_t slotCount;
 
-			float avglength = sqrtf(avgnormal[0] * avgnormal[0] + avgnormal[1] * avgnormal[1] + avgnormal[2] * avgnormal[2]);
+	uint32_t slot;
+	VkDeviceSize offset; // relative to the start of the current slot
+};
 
-			if (avglength == 0.f)
-			{
-				avgnormal[0] = 1.f;
-				avgnormal[1] = 0.f;
-				avgnormal[2] = 0.f;
-			}
-			else
-			{
-				avgnormal[0] /= avglength;
-				avgnormal[1] /= avglength;
-				avgnormal[2] /= avglength;
-			}
+struct UploadAllocation
+{
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	VkDeviceSize size;
 
-			float mindp = 1.f;
+	void* data;
+};
 
-			for (unsigned int i = 0; i < meshlet.triangleCount; ++i)
-			{
-				float dp = normals[i][0] * avgnormal[0] + normals[i][1] * avgnormal[1] + normals[i][2] * avgnormal[2];
+void createUploadAllocator(UploadAllocator& allocator, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, VkDeviceSize slotSize, uint32_t slotCount)
+{
+	// Uniform, storage and indirect data are read by the GPU directly from this memory, so device local memory is preferred when the CPU can write it
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
 
-				mindp = std::min(mindp, dp);
-			}
+	createBuffer(allocator.buffer, device, memoryProperties, size_t(slotSize * slotCount), usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryTag_Upload, {}, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-			float conew = mindp <= 0.f ? 1 : sqrtf(1 - mindp * mindp);
+	allocator.slotSize = slotSize;
+	allocator.slotCount = slotCount;
+	allocator.slot = 0;
+	allocator.offset = 0;
+}
 
-			meshlet.cone[0] = avgnormal[0];
-			meshlet.cone[1] = avgnormal[1];
-			meshlet.cone[2] = avgnormal[2];
-			meshlet.cone[3] = conew;
-		}
-	}
+void destroyUploadAllocator(VkDevice device, UploadAllocator& allocator)
+{
+	destroyBuffer(device, allocator.buffer);
 }
 
-int main(int argc, char** argv)
+// The caller guarantees that the GPU is done with the slot, i.e. that the fence of the last frame that used it has signaled
+void beginUploadSlot(UploadAllocator& allocator, uint32_t slot)
 {
-	if (argc != 2)
-	{
-		printf("Usage: %s <obj_file>\n", argv[0]);
-		return 1;
-	}
+	assert(slot < allocator.slotCount);
 
-	VkInstance instance = createInstance();
-	assert(instance);
+	allocator.slot = slot;
+	allocator.offset = 0;
+}
 
-#ifdef _DEBUG
-	VkDebugReportCallbackEXT debugCallback = registerDebugCallback(instance);
-	assert(debugCallback);
-#endif
+// alignment must be a power of two, e.g. minUniformBufferOffsetAlignment or minStorageBufferOffsetAlignment for descriptors and 4 for indirect commands
+UploadAllocation allocateUpload(UploadAllocator& allocator, VkDeviceSize size, VkDeviceSize alignment)
+{
+	assert(alignment && (alignment & (alignment - 1)) == 0);
 
-	uint32_t physicalDeviceCount = 0;
-	VkPhysicalDevice physicalDevices[16];
-	VK_CHECK(vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, 0));
-	VK_CHECK(vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, physicalDevices));
+	VkDeviceSize offset = (allocator.offset + alignment - 1) & ~(alignment - 1);
+	assert(offset + size <= allocator.slotSize);
 
-	VkPhysicalDevice physicalDevice = pickPhysicalDevice(physicalDevices, physicalDeviceCount);
-	assert(physicalDevice);
+	allocator.offset = offset + size;
 
-	uint32_t familyIndex = getGraphicsQueueFamily(physicalDevice);
-	assert(familyIndex != VK_QUEUE_FAMILY_IGNORED);
+	VkDeviceSize bufferOffset = allocator.slot * allocator.slotSize + offset;
 
-	VkDevice device = createDevice(physicalDevice, familyIndex);
-	assert(device);
+	UploadAllocation result = {};
+	result.buffer = allocator.buffer.buffer;
+	result.offset = bufferOffset;
+	result.size = size;
+	result.data = static_cast<char*>(allocator.buffer.data) + bufferOffset;
+
+	return result;
+}
+
+VkSemaphore createSemaphore(VkDevice device)
+{
+	VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+
+	VkSemaphore semaphore = 0;
+	VK_CHECK(vkCreateSemaphore(device, &createInfo, 0, &semaphore));
+
+	return semaphore;
+}
+
+VkFence createFence(VkDevice device)
+{
+	VkFenceCreateInfo createInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+
+	VkFence fence = 0;
+	VK_CHECK(vkCreateFence(device, &createInfo, 0, &fence));
+
+	return fence;
+}
+
+// Blits that resize the image filter linearly where the source format supports it
+VkFilter getBlitFilter(VkPhysicalDevice physicalDevice, VkFormat format)
+{
+	VkFormatProperties properties = {};
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+
+	return (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+}
+
+VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount)
+{
+	VkQueryPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	createInfo.queryCount = queryCount;
+
+	VkQueryPool queryPool = 0;
+	VK_CHECK(vkCreateQueryPool(device, &createInfo, 0, &queryPool));
+
+	return queryPool;
+}
+
+void recordCullCommands(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkPipelineLayout layout, uint32_t workgroupSize, const Buffer& mb, const Buffer& dcb, const Buffer& mlb, const Buffer& dib, const Buffer& slb, const Buffer& csb, const CullData& cullData)
+{
+	DrawCounts initialCounts = {};
+	initialCounts.softwareGroupCountY = 1;
+	initialCounts.softwareGroupCountZ = 1;
+
+	vkCmdUpdateBuffer(commandBuffer, dcb.buffer, 0, sizeof(initialCounts), &initialCounts);
+
+	// Statistics accumulate from here until the frame that consumes this slot copies them out
+	vkCmdFillBuffer(commandBuffer, csb.buffer, 0, sizeof(CullStats), 0);
+
+	VkBufferMemoryBarrier fillBarriers[2] =
+	{
+		bufferBarrier(dcb.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, sizeof(DrawCounts)),
+		bufferBarrier(csb.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, sizeof(CullStats)),
+	};
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, ARRAYSIZE(fillBarriers), fillBarriers, 0, 0);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+	VkDescriptorBufferInfo mbInfo = { mb.buffer, 0, mb.size };
+	VkDescriptorBufferInfo dcbInfo = { dcb.buffer, 0, dcb.size };
+	VkDescriptorBufferInfo mlbInfo = { mlb.buffer, 0, mlb.size };
+	VkDescriptorBufferInfo dibInfo = { dib.buffer, 0, dib.size };
+	VkDescriptorBufferInfo slbInfo = { slb.buffer, 0, slb.size };
+	VkDescriptorBufferInfo csbInfo = { csb.buffer, 0, csb.size };
+
+	VkWriteDescriptorSet descriptors[] =
+	{
+		bufferDescriptor(0, &mbInfo),
+		bufferDescriptor(1, &dcbInfo),
+		bufferDescriptor(2, &mlbInfo),
+		bufferDescriptor(3, &dibInfo),
+		bufferDescriptor(4, &slbInfo),
+		bufferDescriptor(5, &csbInfo),
+	};
+
+	vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, ARRAYSIZE(descriptors), descriptors);
+	vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cullData), &cullData);
+
+	vkCmdDispatch(commandBuffer, (cullData.meshletCount + workgroupSize - 1) / workgroupSize, 1, 1);
+}
+
+// When timestampPool is set, the start and end of the cull are written to queries firstTimestamp and firstTimestamp + 1
+void recordCull(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usageFlags, VkPipeline pipeline, VkPipelineLayout layout, uint32_t workgroupSize, const Buffer& mb, const Buffer& dcb, const Buffer& mlb, const Buffer& dib, const Buffer& slb, const Buffer& csb, const CullData& cullData, VkQueryPool timestampPool, uint32_t firstTimestamp)
+{
+	VK_CHECK(vkResetCommandPool(device, commandPool, 0));
+
+	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = usageFlags;
+
+	VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+	if (timestampPool)
+	{
+		vkCmdResetQueryPool(commandBuffer, timestampPool, firstTimestamp, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, firstTimestamp);
+	}
+
+	recordCullCommands(commandBuffer, pipeline, layout, workgroupSize, mb, dcb, mlb, dib, slb, csb, cullData);
+
+	if (timestampPool)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, firstTimestamp + 1);
+
+	VK_CHECK(vkEndCommandBuffer(commandBuffer));
+}
+
+void submitCull(VkQueue queue, VkCommandBuffer commandBuffer, VkSemaphore signalSemaphore)
+{
+	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &signalSemaphore;
+	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+}
+
+VkSpecializationInfo getSpecializationInfo(const MeshletConfig& config)
+{
+	static const VkSpecializationMapEntry entries[] =
+	{
+		{ 0, offsetof(MeshletConfig, cullPrepass), sizeof(VkBool32) },
+		{ 1, offsetof(MeshletConfig, taskCull), sizeof(VkBool32) },
+		{ 2, offsetof(MeshletConfig, meshWorkgroupSize), sizeof(uint32_t) },
+		{ 3, offsetof(MeshletConfig, cullWorkgroupSize), sizeof(uint32_t) },
+		{ 4, offsetof(MeshletConfig, cullStats), sizeof(VkBool32) },
+		{ 5, offsetof(MeshletConfig, viewCount), sizeof(uint32_t) },
+	};
+
+	VkSpecializationInfo info = {};
+	info.mapEntryCount = ARRAYSIZE(entries);
+	info.pMapEntries = entries;
+	info.dataSize = sizeof(config);
+	info.pData = &config;
+
+	return info;
+}
+
+VkPipeline createMeshletPipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout, const VkPipelineRenderingCreateInfo* renderingInfo, VkShaderModule taskShader, VkShaderModule vertShader, VkShaderModule fragShader, const MeshletConfig& config, VkPipelineCreateFlags flags = 0)
+{
+	VkSpecializationInfo specializationInfo = getSpecializationInfo(config);
+
+#if RTX
+	return createGraphicsPipeline(device, cache, layout, renderingInfo, { taskShader, vertShader, fragShader }, { VK_SHADER_STAGE_TASK_BIT_NV, VK_SHADER_STAGE_MESH_BIT_NV, VK_SHADER_STAGE_FRAGMENT_BIT }, &specializationInfo, 0, flags);
+#elif VERTEX_INPUT
+	// Binding 0 is the position stream (vb), binding 1 the attribute stream (ab)
+	VkVertexInputBindingDescription bindings[] =
+	{
+		{ 0, sizeof(VertexPosition), VK_VERTEX_INPUT_RATE_VERTEX },
+		{ 1, sizeof(VertexAttributes), VK_VERTEX_INPUT_RATE_VERTEX },
+	};
+
+	VkVertexInputAttributeDescription attributes[] =
+	{
+		{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexPosition, vx) },
+		{ 1, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexAttributes, nx) },
+		{ 2, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(VertexAttributes, tu) },
+	};
+
+	VkPipelineVertexInputStateCreateInfo vertexInputState = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+	vertexInputState.vertexBindingDescriptionCount = ARRAYSIZE(bindings);
+	vertexInputState.pVertexBindingDescriptions = bindings;
+	vertexInputState.vertexAttributeDescriptionCount = ARRAYSIZE(attributes);
+	vertexInputState.pVertexAttributeDescriptions = attributes;
+
+	return createGraphicsPipeline(device, cache, layout, renderingInfo, { vertShader, fragShader }, { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT }, &specializationInfo, &vertexInputState, flags);
+#else
+	return createGraphicsPipeline(device, cache, layout, renderingInfo, { vertShader, fragShader }, { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT }, &specializationInfo, 0, flags);
+#endif
+}
+
+struct TuneEntry
+{
+	uint32_t vendorID;
+	uint32_t deviceID;
+	MeshletConfig config;
+};
+
+// One line per device: vendorID deviceID maxVertices maxTriangles meshWorkgroupSize cullWorkgroupSize taskCull
+void readTuneFile(std::vector<TuneEntry>& entries, const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return;
+
+	TuneEntry entry = {};
+	while (fscanf(file, "%x %x %u %u %u %u %u", &entry.vendorID, &entry.deviceID, &entry.config.maxVertices, &entry.config.maxTriangles, &entry.config.meshWorkgroupSize, &entry.config.cullWorkgroupSize, &entry.config.taskCull) == 7)
+		entries.push_back(entry);
+
+	fclose(file);
+}
+
+bool loadMeshletConfig(MeshletConfig& config, const char* path, const VkPhysicalDeviceProperties& properties)
+{
+	std::vector<TuneEntry> entries;
+	readTuneFile(entries, path);
+
+	for (const TuneEntry& entry : entries)
+		if (entry.vendorID == properties.vendorID && entry.deviceID == properties.deviceID)
+		{
+			// Entries written by other builds may exceed what the shaders were compiled for
+			if (entry.config.maxVertices > kMeshletMaxVertices || entry.config.maxTriangles > kMeshletMaxTriangles)
+				return false;
+
+			config.taskCull = entry.config.taskCull;
+			config.meshWorkgroupSize = entry.config.meshWorkgroupSize;
+			config.cullWorkgroupSize = entry.config.cullWorkgroupSize;
+			config.maxVertices = entry.config.maxVertices;
+			config.maxTriangles = entry.config.maxTriangles;
+			return true;
+		}
+
+	return false;
+}
+
+void saveMeshletConfig(const char* path, const VkPhysicalDeviceProperties& properties, const MeshletConfig& config)
+{
+	std::vector<TuneEntry> entries;
+	readTuneFile(entries, path);
+
+	TuneEntry tuned = { properties.vendorID, properties.deviceID, config };
+
+	bool replaced = false;
+
+	for (TuneEntry& entry : entries)
+		if (entry.vendorID == properties.vendorID && entry.deviceID == properties.deviceID)
+		{
+			entry = tuned;
+			replaced = true;
+		}
+
+	if (!replaced)
+		entries.push_back(tuned);
+
+	FILE* file = fopen(path, "w");
+	if (!file)
+	{
+		printf("Failed to write %s\n", path);
+		return;
+	}
+
+	for (const TuneEntry& entry : entries)
+		fprintf(file, "%04x %04x %u %u %u %u %u\n", entry.vendorID, entry.deviceID, entry.config.maxVertices, entry.config.maxTriangles, entry.config.meshWorkgroupSize, entry.config.cullWorkgroupSize, entry.config.taskCull);
+
+	fclose(file);
+}
+
+// Cross product of the parameters that matter for the current build, limited by what the device supports
+void getTuneCandidates(std::vector<MeshletConfig>& candidates, const MeshletConfig& base, uint32_t maxMeshWorkgroupSize, uint32_t maxComputeWorkgroupSize)
+{
+	const uint32_t shapes[][2] = { { 64, 124 }, { 64, 96 }, { 64, 64 }, { 32, 64 } };
+
+#if RTX
+	const uint32_t meshWorkgroupSizes[] = { 32, 16 };
+#else
+	const uint32_t meshWorkgroupSizes[] = { 32 };
+#endif
+
+#if CULL_PREPASS
+	const uint32_t cullWorkgroupSizes[] = { 32, 64, 128 };
+	const VkBool32 taskCulls[] = { true };
+#else
+	const uint32_t cullWorkgroupSizes[] = { 32 };
+	const VkBool32 taskCulls[] = { true, false };
+#endif
+
+	for (auto& shape : shapes)
+		for (uint32_t meshWorkgroupSize : meshWorkgroupSizes)
+			for (uint32_t cullWorkgroupSize : cullWorkgroupSizes)
+				for (VkBool32 taskCull : taskCulls)
+				{
+					if (meshWorkgroupSize > maxMeshWorkgroupSize || cullWorkgroupSize > maxComputeWorkgroupSize)
+						continue;
+
+					MeshletConfig config = base;
+					config.taskCull = taskCull;
+					config.meshWorkgroupSize = meshWorkgroupSize;
+					config.cullWorkgroupSize = cullWorkgroupSize;
+					config.maxVertices = shape[0];
+					config.maxTriangles = shape[1];
+
+					candidates.push_back(config);
+				}
+}
+
+int main(int argc, char** argv)
+{
+	const char* objPath = 0;
+	const char* shaderPath = 0;
+	bool autotune = false;
+	bool validArgs = true;
+	double gpuBudget = -1; // negative picks a budget from the display refresh rate
+
+	PresentConfig presentConfig = { VSYNC ? VK_PRESENT_MODE_FIFO_KHR : VK_PRESENT_MODE_IMMEDIATE_KHR, 0, false };
+
+	for (int i = 1; i < argc && validArgs; ++i)
+	{
+		if (strcmp(argv[i], "--autotune") == 0)
+			autotune = true;
+		else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc)
+			validArgs = parsePresentMode(argv[++i], presentConfig.presentMode);
+		else if (strcmp(argv[i], "--images") == 0 && i + 1 < argc)
+			presentConfig.imageCount = uint32_t(atoi(argv[++i]));
+		else if (strcmp(argv[i], "--low-latency") == 0)
+			presentConfig.lowLatency = true;
+		else if (strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc)
+			gpuBudget = atof(argv[++i]) / 1000;
+		else if (strcmp(argv[i], "--shaders") == 0 && i + 1 < argc)
+			shaderPath = argv[++i];
+		else if (argv[i][0] != '-' && !objPath)
+			objPath = argv[i];
+		else
+			validArgs = false;
+	}
+
+	if (!objPath || !validArgs)
+	{
+		printf("Usage: %s <obj_file> [--autotune] [--present-mode immediate|mailbox|fifo|fifo_relaxed] [--images <count>] [--low-latency] [--gpu-budget <ms>] [--shaders <dir>]\n", argv[0]);
+		return 1;
+	}
+
+	VkInstance instance = createInstance();
+	assert(instance);
+
+#ifdef _DEBUG
+	VkDebugReportCallbackEXT debugCallback = registerDebugCallback(instance);
+	assert(debugCallback);
+#endif
+
+	uint32_t physicalDeviceCount = 0;
+	VkPhysicalDevice physicalDevices[16];
+	VK_CHECK(vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, 0));
+	VK_CHECK(vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, physicalDevices));
+
+	VkPhysicalDevice physicalDevice = pickPhysicalDevice(physicalDevices, physicalDeviceCount);
+	assert(physicalDevice);
+
+	VkPhysicalDeviceProperties physicalDeviceProperties = {};
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+	VkPhysicalDeviceFeatures physicalDeviceFeatures = {};
+	vkGetPhysicalDeviceFeatures(physicalDevice, &physicalDeviceFeatures);
+
+	VkPhysicalDeviceVulkan12Features physicalDeviceFeatures12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+
+	VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	physicalDeviceFeatures2.pNext = &physicalDeviceFeatures12;
+
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &physicalDeviceFeatures2);
+
+#if CULL_PREPASS && !RTX
+	if (!physicalDeviceFeatures.drawIndirectFirstInstance)
+	{
+		printf("Device does not support drawIndirectFirstInstance, CULL_PREPASS without RTX needs it\n");
+		return 1;
+	}
+
+	if (!physicalDeviceFeatures12.drawIndirectCount)
+	{
+		printf("Device does not support drawIndirectCount, CULL_PREPASS without RTX needs it\n");
+		return 1;
+	}
+#endif
+
+#if VISBUFFER && !RTX
+	if (!physicalDeviceFeatures.geometryShader)
+	{
+		printf("Device does not support geometryShader, VISBUFFER without RTX needs it for gl_PrimitiveID\n");
+		return 1;
+	}
+#endif
+
+#if SWRASTER
+	// The software rasterizer packs depth and visibility into 64-bit values and writes them with atomicMax from compute and fragment shaders
+	if (!physicalDeviceFeatures.shaderInt64 || !physicalDeviceFeatures.fragmentStoresAndAtomics || !physicalDeviceFeatures12.shaderBufferInt64Atomics)
+	{
+		printf("Device does not support shaderInt64, fragmentStoresAndAtomics and shaderBufferInt64Atomics, SWRASTER needs them\n");
+		return 1;
+	}
+#endif
+
+#if RTX || CULL_PREPASS
+	VkShaderStageFlags cullStages = (RTX ? VK_SHADER_STAGE_TASK_BIT_NV : 0) | (CULL_PREPASS ? VK_SHADER_STAGE_COMPUTE_BIT : 0);
+
+	if (!isSubgroupBallotSupported(physicalDevice, cullStages))
+	{
+		printf("Device does not support subgroup ballots in the culling stages (%s)\n", RTX && CULL_PREPASS ? "task, compute" : RTX ? "task" : "compute");
+		return 1;
+	}
+#endif
+
+#if MULTIVIEW
+	VkPhysicalDeviceMultiviewFeatures multiviewFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES };
+
+	VkPhysicalDeviceFeatures2 features2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	features2.pNext = &multiviewFeatures;
+
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+	if (!multiviewFeatures.multiview)
+	{
+		printf("Device does not support multiview, MULTIVIEW needs it\n");
+		return 1;
+	}
+
+	VkPhysicalDeviceMultiviewProperties multiviewProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_PROPERTIES };
+
+	VkPhysicalDeviceMeshShaderPropertiesNV meshShaderProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_NV };
+	meshShaderProperties.pNext = &multiviewProperties;
+
+	VkPhysicalDeviceProperties2 properties2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+	properties2.pNext = &meshShaderProperties;
+
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+	if (kViewCount > multiviewProperties.maxMultiviewViewCount)
+	{
+		printf("Device supports %u views, MULTIVIEW needs %u\n", multiviewProperties.maxMultiviewViewCount, kViewCount);
+		return 1;
+	}
+
+	// Mesh shaders have a separate, possibly lower, view limit
+	if (kViewCount > meshShaderProperties.maxMeshMultiviewViewCount)
+	{
+		printf("Device supports %u mesh shader views, MULTIVIEW needs %u\n", meshShaderProperties.maxMeshMultiviewViewCount, kViewCount);
+		return 1;
+	}
+#endif
+
+	MeshletConfig meshletConfig = { CULL_PREPASS, true, CULL_STATS, 32, 32, kViewCount, kMeshletMaxVertices, kMeshletMaxTriangles };
+
+	if (!autotune && loadMeshletConfig(meshletConfig, kTuneFile, physicalDeviceProperties))
+		printf("Using tuned config from %s: %u vertices, %u triangles, mesh workgroup %u, cull workgroup %u, task cull %u\n", kTuneFile,
+			meshletConfig.maxVertices, meshletConfig.maxTriangles, meshletConfig.meshWorkgroupSize, meshletConfig.cullWorkgroupSize, meshletConfig.taskCull);
+
+	// Autotune renders every candidate for a fixed number of frames and keeps the fastest one for this vendorID/deviceID
+	std::vector<MeshletConfig> tuneCandidates;
+
+	if (autotune)
+	{
+		// Candidates are ranked by GPU time, which CPU frame time doesn't reflect when presentation blocks
+		if (!physicalDeviceProperties.limits.timestampComputeAndGraphics)
+		{
+			printf("Device does not support timestamps on graphics and compute queues, --autotune needs them\n");
+			return 1;
+		}
+
+#if RTX || CULL_PREPASS
+		uint32_t maxMeshWorkgroupSize = 32;
+
+#if RTX
+		VkPhysicalDeviceMeshShaderPropertiesNV meshProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_NV };
+		VkPhysicalDeviceProperties2 properties2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+		properties2.pNext = &meshProperties;
+		vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+		maxMeshWorkgroupSize = meshProperties.maxMeshWorkGroupSize[0];
+#endif
+
+		const VkPhysicalDeviceLimits& limits = physicalDeviceProperties.limits;
+		uint32_t maxComputeWorkgroupSize = limits.maxComputeWorkGroupSize[0] < limits.maxComputeWorkGroupInvocations ? limits.maxComputeWorkGroupSize[0] : limits.maxComputeWorkGroupInvocations;
+
+		getTuneCandidates(tuneCandidates, meshletConfig, maxMeshWorkgroupSize, maxComputeWorkgroupSize);
+		assert(!tuneCandidates.empty());
+
+		printf("Autotuning %d configurations for %s (%04x:%04x)\n", int(tuneCandidates.size()), physicalDeviceProperties.deviceName, physicalDeviceProperties.vendorID, physicalDeviceProperties.deviceID);
+
+		meshletConfig = tuneCandidates[0];
+#else
+		printf("Autotune has nothing to tune without meshlets (RTX or CULL_PREPASS)\n");
+#endif
+	}
+
+	uint32_t familyIndex = getGraphicsQueueFamily(physicalDevice);
+	assert(familyIndex != VK_QUEUE_FAMILY_IGNORED);
+
+	uint32_t computeFamilyIndex = getComputeQueueFamily(physicalDevice, familyIndex);
+	assert(computeFamilyIndex != VK_QUEUE_FAMILY_IGNORED);
+
+	printf("Compute queue family: %d%s\n", computeFamilyIndex, computeFamilyIndex == familyIndex ? " (shared with graphics)" : " (async)");
+
+	bool memoryBudget = isDeviceExtensionSupported(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	bool presentWait = presentConfig.lowLatency && isPresentWaitSupported(physicalDevice);
+
+	if (presentConfig.lowLatency && !presentWait)
+	{
+		printf("VK_KHR_present_wait is not supported, low latency mode is disabled\n");
+		presentConfig.lowLatency = false;
+	}
+
+	// Lets pipeline creation report cache misses instead of compiling, so that cached pipelines don't wait behind compiles
+	bool pipelineCacheControl = isPipelineCacheControlSupported(physicalDevice);
+
+	VkDevice device = createDevice(physicalDevice, familyIndex, computeFamilyIndex, memoryBudget, presentWait, pipelineCacheControl);
+	assert(device);
+
+	ShaderRegistry shaders;
+
+	if (shaderPath)
+		addShaderDirectory(shaders, shaderPath);
+
+	addShaderDirectory(shaders, "src/shaders");
+	addShaderDirectory(shaders, "shaders");
+
+	VkPipelineCache pipelineCache = createPipelineCache(device, kPipelineCacheFile);
+	assert(pipelineCache);
+
+	gMemoryStats.budgetSupported = memoryBudget;
 
 	VkQueue queue;
 	vkGetDeviceQueue(device, familyIndex, 0, &queue);
 
+	VkQueue computeQueue;
+	vkGetDeviceQueue(device, computeFamilyIndex, 0, &computeQueue);
+
 	VkCommandPool commandPool = createCommandPool(device, familyIndex);
 	assert(commandPool);
 
@@ -847,93 +2263,979 @@ int main(int argc, char** argv)
 	int r = glfwInit();
 	assert(r);
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(1024, 720, "Yosemite", 0, 0);
+	assert(window);
+
+	VkSurfaceKHR surface = createSurface(instance, window);
+	assert(surface);
+
+	VkSurfaceFormatKHR surfaceFormat = getSurfaceFormat(physicalDevice, surface);
+
+	presentConfig.presentMode = getPresentMode(physicalDevice, surface, presentConfig.presentMode);
+
+	Swapchain swapchain = {};
+	createSwapchain(swapchain, device, physicalDevice, surface, surfaceFormat, presentConfig, VK_NULL_HANDLE);
+
+	printf("Swapchain: %s, %d images%s\n", kPresentModeNames[presentConfig.presentMode], swapchain.imageCount, presentConfig.lowLatency ? ", low latency" : "");
+
+	double pipelineBegin = glfwGetTime();
+
+	// Leaves a core for the mesh loader; the main thread also compiles while it waits for the first pipelines
+	unsigned int cores = std::thread::hardware_concurrency();
+
+	PipelineCompiler compiler;
+	createPipelineCompiler(compiler, device, pipelineCacheControl, cores > 1 ? cores - 1 : 1);
+
+#if RTX
+	VkShaderModule meshTaskShader = loadShaderModule(device, shaders, "meshlet.task");
+	assert(meshTaskShader);
+	
+#if MULTIVIEW
+	VkShaderModule meshVertShader = loadShaderModule(device, shaders, "meshletview.mesh");
+	assert(meshVertShader);
+#else
+	VkShaderModule meshVertShader = loadShaderModule(device, shaders, "meshlet.mesh");
+	assert(meshVertShader);
+#endif
+#else
+	VkShaderModule meshTaskShader = VK_NULL_HANDLE;
+
+#if VERTEX_INPUT
+	VkShaderModule meshVertShader = loadShaderModule(device, shaders, "meshinput.vert");
+	assert(meshVertShader);
+#else
+	VkShaderModule meshVertShader = loadShaderModule(device, shaders, "mesh.vert");
+	assert(meshVertShader);
+#endif
+#endif
+
+	VkShaderModule meshFragShader = loadShaderModule(device, shaders, "mesh.frag");
+	assert(meshFragShader);
+
+#if RTX
+	VkDescriptorSetLayoutBinding meshBindings[] =
+	{
+		descriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_NV | VK_SHADER_STAGE_TASK_BIT_NV),
+		descriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_NV | VK_SHADER_STAGE_TASK_BIT_NV),
+#if CULL_PREPASS
+		descriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_TASK_BIT_NV),
+		descriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_TASK_BIT_NV),
+#endif
+#if SWRASTER
+		descriptorBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT),
+#endif
+		descriptorBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_NV),
+		descriptorBinding(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_TASK_BIT_NV),
+		descriptorBinding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_NV | VK_SHADER_STAGE_TASK_BIT_NV),
+	};
+#else
+	VkDescriptorSetLayoutBinding meshBindings[] =
+	{
+		descriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
+#if SWRASTER
+		descriptorBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT),
+#endif
+		descriptorBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
+	};
+#endif
+
+	VkDescriptorSetLayout meshSetLayout = createDescriptorSetLayout(device, meshBindings, ARRAYSIZE(meshBindings));
+	assert(meshSetLayout);
+
+#if SWRASTER
+	// Fragments write to the 64-bit visibility buffer and need its row pitch
+	VkPipelineLayout meshLayout = createPipelineLayout(device, meshSetLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uint32_t));
+	assert(meshLayout);
+#else
+	VkPipelineLayout meshLayout = createPipelineLayout(device, meshSetLayout, 0, 0);
+	assert(meshLayout);
+#endif
+
+	VkFormat colorFormats[] = { surfaceFormat.format };
+
+	VkPipelineRenderingCreateInfo meshRenderingInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+	meshRenderingInfo.colorAttachmentCount = ARRAYSIZE(colorFormats);
+	meshRenderingInfo.pColorAttachmentFormats = colorFormats;
+	meshRenderingInfo.viewMask = MULTIVIEW ? (1 << kViewCount) - 1 : 0;
+
+	VkPipeline meshPipeline = 0;
+
+#if VISBUFFER
+#if RTX
+	VkShaderModule visVertShader = loadShaderModule(device, shaders, "meshletvis.mesh");
+	assert(visVertShader);
+#else
+	VkShaderModule visVertShader = loadShaderModule(device, shaders, "meshvis.vert");
+	assert(visVertShader);
+#endif
+
+#if SWRASTER
+	VkShaderModule visFragShader = loadShaderModule(device, shaders, "meshvisatomic.frag");
+	assert(visFragShader);
+
+	// Hardware and software rasterized meshlets resolve visibility through 64-bit atomics; depth only provides early rejection
+	VkPipelineRenderingCreateInfo visRenderingInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+	visRenderingInfo.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT;
+#else
+	VkShaderModule visFragShader = loadShaderModule(device, shaders, "meshvis.frag");
+	assert(visFragShader);
+
+	VkFormat visibilityFormats[] = { VK_FORMAT_R32_UINT };
+
+	VkPipelineRenderingCreateInfo visRenderingInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+	visRenderingInfo.colorAttachmentCount = ARRAYSIZE(visibilityFormats);
+	visRenderingInfo.pColorAttachmentFormats = visibilityFormats;
+	visRenderingInfo.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT;
+#endif
+
+	VkPipeline visPipeline = 0;
+
+#if SWRASTER
+	VkShaderModule resolveShader = loadShaderModule(device, shaders, "visresolveatomic.comp");
+	assert(resolveShader);
+
+	VkDescriptorSetLayoutBinding resolveBindings[] =
+	{
+		descriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+	};
+#else
+	VkShaderModule resolveShader = loadShaderModule(device, shaders, "visresolve.comp");
+	assert(resolveShader);
+
+	VkDescriptorSetLayoutBinding resolveBindings[] =
+	{
+		descriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+	};
+#endif
+
+	VkDescriptorSetLayout resolveSetLayout = createDescriptorSetLayout(device, resolveBindings, ARRAYSIZE(resolveBindings));
+	assert(resolveSetLayout);
+
+	VkPipelineLayout resolveLayout = createPipelineLayout(device, resolveSetLayout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(uint32_t) * 2);
+	assert(resolveLayout);
+
+	VkPipeline resolvePipeline = 0;
+#endif
+
+#if SWRASTER
+	VkShaderModule rasterShader = loadShaderModule(device, shaders, "meshletraster.comp");
+	assert(rasterShader);
+
+	VkDescriptorSetLayoutBinding rasterBindings[] =
+	{
+		descriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+	};
+
+	VkDescriptorSetLayout rasterSetLayout = createDescriptorSetLayout(device, rasterBindings, ARRAYSIZE(rasterBindings));
+	assert(rasterSetLayout);
+
+	VkPipelineLayout rasterLayout = createPipelineLayout(device, rasterSetLayout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(uint32_t) * 2);
+	assert(rasterLayout);
+
+	VkPipeline rasterPipeline = 0;
+#endif
+
+#if CULL_PREPASS
+	VkShaderModule cullShader = loadShaderModule(device, shaders, "meshletcull.comp");
+	assert(cullShader);
+
+	VkDescriptorSetLayoutBinding cullBindings[] =
+	{
+		descriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+		descriptorBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+	};
+
+	VkDescriptorSetLayout cullSetLayout = createDescriptorSetLayout(device, cullBindings, ARRAYSIZE(cullBindings));
+	assert(cullSetLayout);
+
+	VkPipelineLayout cullLayout = createPipelineLayout(device, cullSetLayout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(CullData));
+	assert(cullLayout);
+
+	VkPipeline cullPipeline = 0;
+#endif
+
+	// Pipelines are queued in the order they are needed: the ones that don't depend on the meshlet config, then a set per config in autotune order
+	std::atomic<uint32_t> basePending(0);
+
+#if VISBUFFER
+	requestPipeline(compiler, resolvePipeline, basePending, [&](VkPipelineCreateFlags flags) { return createComputePipeline(device, pipelineCache, resolveLayout, resolveShader, 0, flags); });
+#endif
+
+#if SWRASTER
+	requestPipeline(compiler, rasterPipeline, basePending, [&](VkPipelineCreateFlags flags) { return createComputePipeline(device, pipelineCache, rasterLayout, rasterShader, 0, flags); });
+#endif
+
+	std::vector<MeshletConfig> variantConfigs = tuneCandidates.empty() ? std::vector<MeshletConfig>(1, meshletConfig) : tuneCandidates;
+	std::vector<MeshletPipelines> variants(variantConfigs.size());
+
+	for (size_t i = 0; i < variants.size(); ++i)
+	{
+		MeshletConfig config = variantConfigs[i];
+
+		requestPipeline(compiler, variants[i].mesh, variants[i].pending, [&, config](VkPipelineCreateFlags flags) { return createMeshletPipeline(device, pipelineCache, meshLayout, &meshRenderingInfo, meshTaskShader, meshVertShader, meshFragShader, config, flags); });
+
+#if VISBUFFER
+		requestPipeline(compiler, variants[i].vis, variants[i].pending, [&, config](VkPipelineCreateFlags flags) { return createMeshletPipeline(device, pipelineCache, meshLayout, &visRenderingInfo, meshTaskShader, visVertShader, visFragShader, config, flags); });
+#endif
+
+#if CULL_PREPASS
+		requestPipeline(compiler, variants[i].cull, variants[i].pending, [&, config](VkPipelineCreateFlags flags)
+		{
+			VkSpecializationInfo specializationInfo = getSpecializationInfo(config);
+			return createComputePipeline(device, pipelineCache, cullLayout, cullShader, &specializationInfo, flags);
+		});
+#endif
+	}
+
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+#if VISBUFFER || OFFSCREEN_COLOR
+	// Offscreen color, blitted to the swapchain image (and upscaled when the render extent is smaller)
+	Image colorTarget = {};
+	VkFormat colorFormat = VISBUFFER ? VK_FORMAT_R8G8B8A8_UNORM : surfaceFormat.format;
+	VkFilter upscaleFilter = getBlitFilter(physicalDevice, colorFormat);
+#endif
+
+#if VISBUFFER
+	// Render targets for the visibility pass, resolved into colorTarget
+	Image visibilityTarget = {};
+	Image depthTarget = {};
+
+#if SWRASTER
+	// 64-bit depth|payload per pixel, written with atomicMax by both rasterizers
+	Buffer visibilityBuffer = {};
+#endif
+#endif
+
+	DeletionQueue deletionQueue = {};
+
+	// Rendering covers the top left renderWidth x renderHeight corner of render targets that may be larger, see DYNAMIC_RESOLUTION; with MULTIVIEW that is per view
+	uint32_t renderWidth = swapchain.width / kViewCount;
+	uint32_t renderHeight = swapchain.height;
+	uint32_t targetWidth = 0;
+	uint32_t targetHeight = 0;
+
+	auto createRenderTargets = [&](uint32_t width, uint32_t height)
+	{
+#if VISBUFFER
+#if SWRASTER
+		createBuffer(visibilityBuffer, device, memoryProperties, size_t(width) * height * sizeof(uint64_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_RenderTarget);
+#else
+		createImage(visibilityTarget, device, memoryProperties, width, height, VK_FORMAT_R32_UINT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT, MemoryTag_RenderTarget);
+#endif
+		createImage(depthTarget, device, memoryProperties, width, height, VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, MemoryTag_RenderTarget);
+		createImage(colorTarget, device, memoryProperties, width, height, colorFormat, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT, MemoryTag_RenderTarget);
+#elif OFFSCREEN_COLOR
+		createImage(colorTarget, device, memoryProperties, width, height, colorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT, MemoryTag_RenderTarget, kViewCount);
+#endif
+
+		targetWidth = width;
+		targetHeight = height;
+	};
+
+	// Targets are retired rather than destroyed since they are replaced between frames without waiting for the device
+	auto destroyRenderTargets = [&]()
+	{
+#if VISBUFFER
+#if SWRASTER
+		retireObject(deletionQueue, [device, buffer = visibilityBuffer]() mutable { destroyBuffer(device, buffer); });
+#else
+		retireObject(deletionQueue, [device, image = visibilityTarget]() mutable { destroyImage(device, image); });
+#endif
+		retireObject(deletionQueue, [device, image = depthTarget]() mutable { destroyImage(device, image); });
+#endif
+
+#if VISBUFFER || OFFSCREEN_COLOR
+		retireObject(deletionQueue, [device, image = colorTarget]() mutable { destroyImage(device, image); });
+#endif
+	};
+
+	createRenderTargets(swapchain.width / kViewCount, swapchain.height);
+
+	bool loadMeshlets = (RTX || CULL_PREPASS) ? true : false;
+
+	double loadBegin = glfwGetTime();
+
+	// Owned by the loader until meshLoaded is set; the render loop only touches it afterwards
+	Mesh mesh = {};
+	std::atomic<bool> meshLoaded(false);
+
+	// Autotune rebuilds every candidate from the mesh as loadMesh had it before meshlets were built and sorted
+	Mesh tuneMesh = {};
+	Mesh* tuneBase = tuneCandidates.empty() ? 0 : &tuneMesh;
+
+#if ASYNC_LOAD
+	// Preprocessing runs while the first frames are already presented; autotune only changes the meshlet limits once the mesh is resident
+	std::thread loader([&mesh, &meshLoaded, objPath, loadMeshlets, meshletConfig, tuneBase]()
+	{
+		loadMesh(mesh, objPath, loadMeshlets, meshletConfig.maxVertices, meshletConfig.maxTriangles, tuneBase);
+		meshLoaded.store(true, std::memory_order_release);
+	});
+#else
+	loadMesh(mesh, objPath, loadMeshlets, meshletConfig.maxVertices, meshletConfig.maxTriangles, tuneBase);
+	meshLoaded.store(true, std::memory_order_release);
+#endif
+
+	std::vector<uint32_t> sharedFamilies = { familyIndex, computeFamilyIndex };
+
+	Buffer scratch = {};
+	createBuffer(scratch, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryTag_Staging);
+
+	// Vertex streams: vb holds positions only (visibility, software raster), ab holds normals and texture coordinates for shading
+	Buffer vb = {};
+	createBuffer(vb, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Vertex);
+	Buffer ab = {};
+	createBuffer(ab, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Vertex);
+	Buffer ib = {};
+	createBuffer(ib, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Index);
+
+#if RTX || CULL_PREPASS
+	Buffer mb = {};
+	createBuffer(mb, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Meshlet, sharedFamilies);
+
+	// Cull outputs are sized for as many meshlets as mb can hold, so they can be created before the mesh is loaded
+	size_t meshletCapacity = mb.size / sizeof(Meshlet);
+#endif
+
+	// Known once the mesh is loaded: meshes with more than 64K vertices are split into chunks that can each use 16-bit indices, 32-bit indices are only used when that fails
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+	bool meshReady = false;
+	bool meshResident = false;
+
+	MeshStream meshStream = {};
+	createMeshStream(meshStream, device, familyIndex);
+
+	// Picks up the mesh once the loader is done and keeps one upload batch in flight; returns true when more of the mesh became drawable
+	auto streamMesh = [&]() -> bool
+	{
+		if (!meshReady)
+		{
+			if (!meshLoaded.load(std::memory_order_acquire))
+				return false;
+
+#if ASYNC_LOAD
+			loader.join();
+#endif
+
+#if RTX || CULL_PREPASS
+			assert(mesh.meshlets.size() <= meshletCapacity);
+#endif
+
+			indexType = mesh.indices16.empty() ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+			meshReady = true;
+
+			printf("Loaded in %.2f s, indices: %s, %d chunks\n", glfwGetTime() - loadBegin, indexType == VK_INDEX_TYPE_UINT16 ? "16-bit" : "32-bit", int(mesh.indexChunks.size()));
+		}
+
+		if (meshResident)
+			return false;
+
+#if RTX || CULL_PREPASS
+		bool published = updateMeshStream(meshStream, device, queue, mesh, indexType, scratch, vb, ab, ib, &mb);
+#else
+		bool published = updateMeshStream(meshStream, device, queue, mesh, indexType, scratch, vb, ab, ib, 0);
+#endif
+
+		if (isMeshResident(meshStream, mesh))
+		{
+			meshResident = true;
+
+			printf("Resident in %.2f s\n", glfwGetTime() - loadBegin);
+		}
+
+		return published;
+	};
+
+#if !ASYNC_LOAD
+	// Everything is uploaded before the first frame
+	while (!meshResident)
+	{
+		streamMesh();
+
+		if (meshStream.pending)
+			VK_CHECK(vkWaitForFences(device, 1, &meshStream.fence, VK_TRUE, ~0ull));
+	}
+#endif
+
+	// The remaining configs keep compiling in the background while the first one renders
+	waitPipelines(compiler, basePending);
+	waitPipelines(compiler, variants[0].pending);
+
+	meshPipeline = variants[0].mesh;
+	visPipeline = variants[0].vis;
+	cullPipeline = variants[0].cull;
+
+	printf("Pipelines: %d from cache, %d compiled on %d threads in %.2f s\n", int(compiler.cacheHits), int(compiler.compileCount), int(compiler.threads.size()), glfwGetTime() - pipelineBegin);
+
+#if UPLOADS
+	UploadAllocator uploads = {};
+	createUploadAllocator(uploads, device, memoryProperties, kUploadSlotSize, kUploadSlots);
+
+	printf("Upload memory: %s\n", (uploads.buffer.memoryFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? "device local" : "host");
+#endif
+
+#if RTX
+	// Views are copied to the frame's upload slot every frame; the single view path binds them too since the task shader declares them
+	View views[kViewCount] = {};
+
+	// Spread over 0.4 radians around the single view camera
+	for (uint32_t i = 0; i < kViewCount; ++i)
+		buildView(views[i], kViewCount > 1 ? (float(i) / (kViewCount - 1) - 0.5f) * 0.4f : 0.f);
+
+	UploadAllocation viewUpload = {};
+#endif
+
+#if !CULL_PREPASS
+	// Draw arguments follow the resident part of the mesh, so they are written every frame instead of being baked into the command buffer
+	UploadAllocation drawUpload = {};
+#endif
+
+#if STATIC_COMMANDS
+	// Pre-recorded command buffers are resubmitted as is; see invalidation on swapchain and scene changes below
+	VkCommandBufferUsageFlags recordFlags = 0;
+#else
+	VkCommandBufferUsageFlags recordFlags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+#endif
+
+#if CULL_PREPASS
+	// Culling results are double-buffered: the compute queue culls frame N+1 while frame N is rasterized
+	const uint32_t cullSlotCount = 2;
+#else
+	const uint32_t cullSlotCount = 1;
+#endif
+
+	// Statistics follow the culling results; the shaders always bind them, CULL_STATS decides whether they're written
+	Buffer csb[cullSlotCount] = {};
+
+	// Start and end of the frame command buffer, followed by start and end of each cull slot; the frame fence is waited every frame so results are read back without stalling
+	const uint32_t timestampCount = CULL_PREPASS ? 2 + 2 * cullSlotCount : 2;
+
+	// Autotune ranks candidates by GPU time; without timestamps DYNAMIC_RESOLUTION keeps the frame at full resolution
+	bool timestampsSupported = physicalDeviceProperties.limits.timestampComputeAndGraphics;
+	bool timestampsUsed = DYNAMIC_RESOLUTION || !tuneCandidates.empty();
+
+	VkQueryPool timestampPool = timestampsSupported && timestampsUsed ? createQueryPool(device, timestampCount) : VK_NULL_HANDLE;
+	assert(timestampPool || !timestampsSupported || !timestampsUsed);
+
+	// Time of the last completed frame command buffer, and of the cull that it consumed
+	double gpuTime = 0.0;
+	double cullTime = 0.0;
+
+	for (uint32_t i = 0; i < cullSlotCount; i++)
+		createBuffer(csb[i], device, memoryProperties, sizeof(CullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Cull, sharedFamilies);
+
+#if CULL_PREPASS
+	Buffer dcb[cullSlotCount] = {};
+	Buffer mlb[cullSlotCount] = {};
+	Buffer dib[cullSlotCount] = {};
+	Buffer slb[cullSlotCount] = {};
+
+	VkCommandPool cullCommandPools[cullSlotCount] = {};
+	VkCommandBuffer cullCommandBuffers[cullSlotCount] = {};
+	VkSemaphore cullSemaphores[cullSlotCount] = {};
+
+	for (uint32_t i = 0; i < cullSlotCount; i++)
+	{
+		createBuffer(dcb[i], device, memoryProperties, sizeof(DrawCounts), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Cull, sharedFamilies);
+		createBuffer(mlb[i], device, memoryProperties, meshletCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Cull, sharedFamilies);
+		createBuffer(dib[i], device, memoryProperties, meshletCapacity * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Cull, sharedFamilies);
+		createBuffer(slb[i], device, memoryProperties, meshletCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag_Cull, sharedFamilies);
+
+		cullCommandPools[i] = createCommandPool(device, computeFamilyIndex);
+		assert(cullCommandPools[i]);
+
+		VkCommandBufferAllocateInfo cullAllocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		cullAllocateInfo.commandBufferCount = 1;
+		cullAllocateInfo.commandPool = cullCommandPools[i];
+		cullAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+		VK_CHECK(vkAllocateCommandBuffers(device, &cullAllocateInfo, &cullCommandBuffers[i]));
+
+		cullSemaphores[i] = createSemaphore(device);
+		assert(cullSemaphores[i]);
+	}
+
+	// Follows the resident meshlets while the mesh streams in
+	CullData cullData = {};
+	cullData.meshletCount = meshStream.readyMeshlets;
+	cullData.softwareThreshold = SWRASTER ? kSoftwareRasterThreshold : 0.f;
+	cullData.viewportWidth = float(swapchain.width);
+	cullData.viewportHeight = float(swapchain.height);
+
+	// Cull command buffers only depend on the viewport and the meshlets, so static mode records them once per slot
+	bool cullRecorded[cullSlotCount] = {};
+
+	// Cull the first frame up front; subsequent frames are culled while the previous one renders
+	recordCull(device, cullCommandPools[0], cullCommandBuffers[0], recordFlags, cullPipeline, cullLayout, meshletConfig.cullWorkgroupSize, mb, dcb[0], mlb[0], dib[0], slb[0], csb[0], cullData, timestampPool, 2);
+	cullRecorded[0] = true;
+
+	submitCull(computeQueue, cullCommandBuffers[0], cullSemaphores[0]);
+#endif
+
+#if CULL_STATS
+	Buffer statsReadback = {};
+	createBuffer(statsReadback, device, memoryProperties, kCullStatsLatency * sizeof(CullStats), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryTag_Cull);
+
+	// Copies from each stats slot to each readback slot never change, so they are recorded once and submitted after the frame command buffer
+	VkCommandPool statsCommandPool = createCommandPool(device, familyIndex, 0);
+	assert(statsCommandPool);
+
+	VkCommandBuffer statsCommandBuffers[kCullStatsLatency][cullSlotCount] = {};
+
+	VkCommandBufferAllocateInfo statsAllocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	statsAllocateInfo.commandBufferCount = kCullStatsLatency * cullSlotCount;
+	statsAllocateInfo.commandPool = statsCommandPool;
+	statsAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+	VK_CHECK(vkAllocateCommandBuffers(device, &statsAllocateInfo, &statsCommandBuffers[0][0]));
+
+	for (uint32_t i = 0; i < kCullStatsLatency; i++)
+		for (uint32_t j = 0; j < cullSlotCount; j++)
+		{
+			VkCommandBuffer statsCommandBuffer = statsCommandBuffers[i][j];
+
+			VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+			VK_CHECK(vkBeginCommandBuffer(statsCommandBuffer, &beginInfo));
+
+			// Covers the task shader writes in this submission and, through the cull semaphore wait at the draw indirect stage, the cull pass
+			VkBufferMemoryBarrier copyBarrier = bufferBarrier(csb[j].buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, sizeof(CullStats));
+			vkCmdPipelineBarrier(statsCommandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | (RTX ? VK_PIPELINE_STAGE_TASK_SHADER_BIT_NV : 0), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 1, &copyBarrier, 0, 0);
+
+			VkBufferCopy region = { 0, i * sizeof(CullStats), sizeof(CullStats) };
+			vkCmdCopyBuffer(statsCommandBuffer, csb[j].buffer, statsReadback.buffer, 1, &region);
+
+			VkBufferMemoryBarrier readbackBarrier = bufferBarrier(statsReadback.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT, VK_WHOLE_SIZE);
+			vkCmdPipelineBarrier(statsCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, 0, 1, &readbackBarrier, 0, 0);
+
+			VK_CHECK(vkEndCommandBuffer(statsCommandBuffer));
+		}
+
+	CullStats cullStats = {};
+#endif
+
+	VkSemaphore acquireSemaphore = createSemaphore(device);
+	assert(acquireSemaphore);
+
+	VkSemaphore submitSemaphore = createSemaphore(device);
+	assert(submitSemaphore);
+
+	VkFence frameFence = createFence(device);
+	assert(frameFence);
+
+	double frameBegin = 0.0;
+	double frameEnd = 0.0;
+	double deltaTime = 0.0;
+
+	uint64_t frameIndex = 0;
+
+	// Set when acquire or present reports that the swapchain no longer matches the surface
+	bool swapchainDirty = false;
+
+	// Present ids are per swapchain and restart when it's recreated; 0 means no frame has been presented yet
+	uint64_t presentId = 0;
+	double inputTimes[kLatencyHistory] = {};
+
+	double frameCost = 0.0;
+	double latency = 0.0;
+	double latencyMin = 1e30, latencyMax = 0.0, latencySum = 0.0;
+	uint64_t latencyCount = 0;
+
+	const GLFWvidmode* videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	double refreshInterval = videoMode && videoMode->refreshRate > 0 ? 1.0 / videoMode->refreshRate : 0.0;
+
+#if DYNAMIC_RESOLUTION
+	RenderScale renderScale = {};
+	renderScale.budget = gpuBudget >= 0 ? gpuBudget : (refreshInterval > 0 ? refreshInterval : 1.0 / 60) * 0.9;
+	renderScale.scale = kRenderScaleMax;
+
+	// Autotune compares variants at a fixed resolution
+	if (autotune || !timestampPool)
+		renderScale.budget = 0;
+#endif
+
+	std::vector<double> tuneResults(tuneCandidates.size());
+	size_t tuneIndex = 0;
+	int tuneFrame = 0;
+	double tuneTime = 0.0;
+
+	bool memoryKeyDown = false;
+
+	// Everything the frame submits; captures resources by reference so that recording always sees the current swapchain, pipelines and buffers
+	auto recordFrame = [&](VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t cullSlot, VkCommandBufferUsageFlags usageFlags)
+	{
+		VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+		beginInfo.flags = usageFlags;
+
+		VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+		if (timestampPool)
+		{
+			vkCmdResetQueryPool(commandBuffer, timestampPool, 0, 2);
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 0);
+		}
+
+#if CULL_STATS && !CULL_PREPASS
+		// Without the prepass the task shader is the only writer (and without RTX nothing culls); the previous frame's copy has completed
+		vkCmdFillBuffer(commandBuffer, csb[0].buffer, 0, sizeof(CullStats), 0);
+
+		VkBufferMemoryBarrier statsBarrier = bufferBarrier(csb[0].buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT, sizeof(CullStats));
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, RTX ? VK_PIPELINE_STAGE_TASK_SHADER_BIT_NV : VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 1, &statsBarrier, 0, 0);
+#endif
+
+#if SWRASTER
+		// Zero is the empty pixel: it is below any depth|payload value written with atomicMax
+		vkCmdFillBuffer(commandBuffer, visibilityBuffer.buffer, 0, visibilityBuffer.size, 0);
+
+		VkBufferMemoryBarrier clearBarrier = bufferBarrier(visibilityBuffer.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_WHOLE_SIZE);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 1, &clearBarrier, 0, 0);
+
+		VkRenderingAttachmentInfo depthAttachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.imageView = depthTarget.imageView;
+		depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+		depthAttachment.clearValue.depthStencil.depth = 0.f;
+
+		VkRenderingInfo passInfo = { VK_STRUCTURE_TYPE_RENDERING_INFO };
+		passInfo.layerCount = 1;
+		passInfo.pDepthAttachment = &depthAttachment;
+		passInfo.renderArea.extent = { renderWidth, renderHeight };
+
+		VkImageMemoryBarrier renderBarrier = imageBarrier(depthTarget.image, 0, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+		renderBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &renderBarrier);
+
+		vkCmdBeginRendering(commandBuffer, &passInfo);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visPipeline);
+
+		uint32_t visibilityPitch = renderWidth;
+		vkCmdPushConstants(commandBuffer, meshLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(visibilityPitch), &visibilityPitch);
+#elif VISBUFFER
+		VkRenderingAttachmentInfo colorAttachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.imageView = visibilityTarget.imageView;
+		colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.clearValue.color.uint32[0] = ~0u;
+
+		VkRenderingAttachmentInfo depthAttachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.imageView = depthTarget.imageView;
+		depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+		depthAttachment.clearValue.depthStencil.depth = 0.f;
+
+		VkRenderingInfo passInfo = { VK_STRUCTURE_TYPE_RENDERING_INFO };
+		passInfo.layerCount = 1;
+		passInfo.colorAttachmentCount = 1;
+		passInfo.pColorAttachments = &colorAttachment;
+		passInfo.pDepthAttachment = &depthAttachment;
+		passInfo.renderArea.extent = { renderWidth, renderHeight };
+
+		VkImageMemoryBarrier renderBarriers[2] =
+		{
+			imageBarrier(visibilityTarget.image, 0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+			imageBarrier(depthTarget.image, 0, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL),
+		};
+
+		renderBarriers[1].subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, ARRAYSIZE(renderBarriers), renderBarriers);
+
+		vkCmdBeginRendering(commandBuffer, &passInfo);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visPipeline);
+#else
+		VkRenderingAttachmentInfo colorAttachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+#if OFFSCREEN_COLOR
+		colorAttachment.imageView = colorTarget.imageView;
+#else
+		colorAttachment.imageView = swapchain.imageViews[imageIndex];
+#endif
+		colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.clearValue.color = { 0.1f, 0.1f, 0.15f, 1.0f };
+
+		VkRenderingInfo passInfo = { VK_STRUCTURE_TYPE_RENDERING_INFO };
+		passInfo.layerCount = 1;
+		passInfo.colorAttachmentCount = 1;
+		passInfo.pColorAttachments = &colorAttachment;
+		passInfo.renderArea.extent = { renderWidth, renderHeight };
+		passInfo.viewMask = meshRenderingInfo.viewMask;
+
+#if OFFSCREEN_COLOR
+		VkImageMemoryBarrier renderBarrier = imageBarrier(colorTarget.image, 0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &renderBarrier);
+#else
+		VkImageMemoryBarrier renderBarrier = imageBarrier(swapchain.images[imageIndex], 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &renderBarrier);
+#endif
+
+		vkCmdBeginRendering(commandBuffer, &passInfo);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+#endif
+
+		VkViewport viewport = { 0.0f, 0.0f, float(renderWidth), float(renderHeight), 0.0f, 1.0f };
+		VkRect2D scissor = { {0, 0}, {renderWidth, renderHeight} };
+
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		VkDescriptorBufferInfo vbInfo = {};
+		vbInfo.buffer = vb.buffer;
+		vbInfo.offset = 0;
+		vbInfo.range = vb.size;
+
+		VkDescriptorBufferInfo abInfo = { ab.buffer, 0, ab.size };
+
+#if RTX || CULL_PREPASS
+		VkDescriptorBufferInfo mbInfo = {};
+		mbInfo.buffer = mb.buffer;
+		mbInfo.offset = 0;
+		mbInfo.range = mb.size;
+#endif
+
+#if SWRASTER
+		VkDescriptorBufferInfo visibilityInfo = { visibilityBuffer.buffer, 0, visibilityBuffer.size };
+#endif
+
+#if RTX
+		VkDescriptorBufferInfo csbInfo = { csb[cullSlot].buffer, 0, csb[cullSlot].size };
+		VkDescriptorBufferInfo viewInfo = { viewUpload.buffer, viewUpload.offset, viewUpload.size };
+
+#if CULL_PREPASS
+		VkDescriptorBufferInfo dcbInfo = { dcb[cullSlot].buffer, 0, dcb[cullSlot].size };
+		VkDescriptorBufferInfo mlbInfo = { mlb[cullSlot].buffer, 0, mlb[cullSlot].size };
+
+		VkWriteDescriptorSet descriptors[] =
+		{
+			bufferDescriptor(0, &vbInfo),
+			bufferDescriptor(1, &mbInfo),
+			bufferDescriptor(2, &dcbInfo),
+			bufferDescriptor(3, &mlbInfo),
+#if SWRASTER
+			bufferDescriptor(4, &visibilityInfo),
+#endif
+			bufferDescriptor(5, &abInfo),
+			bufferDescriptor(6, &csbInfo),
+			bufferDescriptor(7, &viewInfo),
+		};
+
+		vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayout, 0, ARRAYSIZE(descriptors), descriptors);
+
+		vkCmdDrawMeshTasksIndirectNV(commandBuffer, dcb[cullSlot].buffer, 0, 1, sizeof(VkDrawMeshTasksIndirectCommandNV));
+#else
+		VkWriteDescriptorSet descriptors[] =
+		{
+			bufferDescriptor(0, &vbInfo),
+			bufferDescriptor(1, &mbInfo),
+			bufferDescriptor(5, &abInfo),
+			bufferDescriptor(6, &csbInfo),
+			bufferDescriptor(7, &viewInfo),
+		};
+
+		vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayout, 0, ARRAYSIZE(descriptors), descriptors);
+		
+		vkCmdDrawMeshTasksIndirectNV(commandBuffer, drawUpload.buffer, drawUpload.offset, 1, sizeof(VkDrawMeshTasksIndirectCommandNV));
+#endif
+#else
+#if VERTEX_INPUT
+		VkBuffer vertexBuffers[] = { vb.buffer, ab.buffer };
+		VkDeviceSize vertexOffsets[] = { 0, 0 };
+
+		vkCmdBindVertexBuffers(commandBuffer, 0, ARRAYSIZE(vertexBuffers), vertexBuffers, vertexOffsets);
+#else
+		VkWriteDescriptorSet descriptors[] =
+		{
+			bufferDescriptor(0, &vbInfo),
+#if SWRASTER
+			bufferDescriptor(4, &visibilityInfo),
+#endif
+			bufferDescriptor(5, &abInfo),
+		};
+
+		vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayout, 0, ARRAYSIZE(descriptors), descriptors);
+#endif
+		vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, indexType);
+
+#if CULL_PREPASS
+		// Every visible meshlet covers a contiguous index range, see Meshlet::indexOffset
+		vkCmdDrawIndexedIndirectCount(commandBuffer, dib[cullSlot].buffer, 0, dcb[cullSlot].buffer, offsetof(DrawCounts, visibleCount), meshStream.readyMeshlets, sizeof(VkDrawIndexedIndirectCommand));
+#else
+		// One draw per index chunk; drawing them separately doesn't need the multiDrawIndirect feature
+		for (VkDeviceSize offset = 0; offset < drawUpload.size; offset += sizeof(VkDrawIndexedIndirectCommand))
+			vkCmdDrawIndexedIndirect(commandBuffer, drawUpload.buffer, drawUpload.offset + offset, 1, sizeof(VkDrawIndexedIndirectCommand));
+#endif
+#endif
+
+		vkCmdEndRendering(commandBuffer);
+
+#if SWRASTER
+		// Small meshlets routed to the software list by the cull pass, one workgroup each
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rasterPipeline);
+
+		VkDescriptorBufferInfo slbInfo = { slb[cullSlot].buffer, 0, slb[cullSlot].size };
+
+		VkWriteDescriptorSet rasterDescriptors[] =
+		{
+			bufferDescriptor(0, &vbInfo),
+			bufferDescriptor(1, &mbInfo),
+			bufferDescriptor(2, &slbInfo),
+			bufferDescriptor(3, &visibilityInfo),
+		};
+
+		vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rasterLayout, 0, ARRAYSIZE(rasterDescriptors), rasterDescriptors);
+
+		uint32_t rasterSize[2] = { renderWidth, renderHeight };
+		vkCmdPushConstants(commandBuffer, rasterLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(rasterSize), rasterSize);
+
+		vkCmdDispatchIndirect(commandBuffer, dcb[cullSlot].buffer, offsetof(DrawCounts, softwareGroupCountX));
+
+		VkBufferMemoryBarrier visibilityBarrier = bufferBarrier(visibilityBuffer.buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_WHOLE_SIZE);
+		VkImageMemoryBarrier resolveBarrier = imageBarrier(colorTarget.image, 0, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 1, &visibilityBarrier, 1, &resolveBarrier);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, resolvePipeline);
 
-	GLFWwindow* window = glfwCreateWindow(1024, 720, "Yosemite", 0, 0);
-	assert(window);
+		VkDescriptorImageInfo colorInfo = { VK_NULL_HANDLE, colorTarget.imageView, VK_IMAGE_LAYOUT_GENERAL };
 
-	VkSurfaceKHR surface = createSurface(instance, window);
-	assert(surface);
+		VkWriteDescriptorSet resolveDescriptors[] =
+		{
+			bufferDescriptor(0, &vbInfo),
+			bufferDescriptor(1, &mbInfo),
+			bufferDescriptor(2, &visibilityInfo),
+			imageDescriptor(3, &colorInfo),
+			bufferDescriptor(4, &abInfo),
+		};
+#elif VISBUFFER
+		VkImageMemoryBarrier resolveBarriers[2] =
+		{
+			imageBarrier(visibilityTarget.image, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL),
+			imageBarrier(colorTarget.image, 0, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL),
+		};
 
-	VkSurfaceFormatKHR surfaceFormat = getSurfaceFormat(physicalDevice, surface);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, ARRAYSIZE(resolveBarriers), resolveBarriers);
 
-	Swapchain swapchain = {};
-	createSwapchain(swapchain, device, physicalDevice, surface, surfaceFormat, VK_NULL_HANDLE);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, resolvePipeline);
 
-#if RTX
-	VkShaderModule meshTaskShader = loadShaderModule(device, "src/shaders/meshlet.task.spv");
-	assert(meshTaskShader);
-	
-	VkShaderModule meshVertShader = loadShaderModule(device, "src/shaders/meshlet.mesh.spv");
-	assert(meshVertShader);
-#else
-	VkShaderModule meshVertShader = loadShaderModule(device, "src/shaders/mesh.vert.spv");
-	assert(meshVertShader);
+		VkDescriptorImageInfo visibilityInfo = { VK_NULL_HANDLE, visibilityTarget.imageView, VK_IMAGE_LAYOUT_GENERAL };
+		VkDescriptorImageInfo colorInfo = { VK_NULL_HANDLE, colorTarget.imageView, VK_IMAGE_LAYOUT_GENERAL };
+
+		VkWriteDescriptorSet resolveDescriptors[] =
+		{
+			bufferDescriptor(0, &vbInfo),
+			bufferDescriptor(1, &mbInfo),
+			imageDescriptor(2, &visibilityInfo),
+			imageDescriptor(3, &colorInfo),
+			bufferDescriptor(4, &abInfo),
+		};
 #endif
 
-	VkShaderModule meshFragShader = loadShaderModule(device, "src/shaders/mesh.frag.spv");
-	assert(meshFragShader);
+#if VISBUFFER
+		vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, resolveLayout, 0, ARRAYSIZE(resolveDescriptors), resolveDescriptors);
 
-	VkDescriptorSetLayout meshSetLayout = createDescriptorSetLayout(device);
-	assert(meshSetLayout);
+		uint32_t imageSize[2] = { renderWidth, renderHeight };
+		vkCmdPushConstants(commandBuffer, resolveLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(imageSize), imageSize);
 
-	VkPipelineLayout meshLayout = createPipelineLayout(device, meshSetLayout);
-	assert(meshLayout);
+		vkCmdDispatch(commandBuffer, (renderWidth + 7) / 8, (renderHeight + 7) / 8, 1);
 
-	VkFormat colorFormats[] = { surfaceFormat.format };
+		VkImageMemoryBarrier blitBarriers[2] =
+		{
+			imageBarrier(colorTarget.image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
+			imageBarrier(swapchain.images[imageIndex], 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
+		};
 
-	VkPipelineRenderingCreateInfo meshRenderingInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
-	meshRenderingInfo.colorAttachmentCount = ARRAYSIZE(colorFormats);
-	meshRenderingInfo.pColorAttachmentFormats = colorFormats;
+		VkPipelineStageFlags blitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+#elif OFFSCREEN_COLOR
+		VkImageMemoryBarrier blitBarriers[2] =
+		{
+			imageBarrier(colorTarget.image, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
+			imageBarrier(swapchain.images[imageIndex], 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
+		};
 
-#if RTX
-	VkPipeline meshPipeline = createGraphicsPipeline(device, 0, meshLayout, &meshRenderingInfo, { meshTaskShader, meshVertShader, meshFragShader }, { VK_SHADER_STAGE_TASK_BIT_NV, VK_SHADER_STAGE_MESH_BIT_NV, VK_SHADER_STAGE_FRAGMENT_BIT });
-	assert(meshPipeline);
-#else
-	VkPipeline meshPipeline = createGraphicsPipeline(device, 0, meshLayout, &meshRenderingInfo, { meshVertShader, meshFragShader }, { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT });
-	assert(meshPipeline);
+		VkPipelineStageFlags blitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 #endif
 
-	VkPhysicalDeviceMemoryProperties memoryProperties = {};
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-
-	bool buildMeshlets = RTX ? true : false;
+#if VISBUFFER || OFFSCREEN_COLOR
+		// The acquire semaphore is waited at the transfer stage, which the swapchain layout transition has to come after
+		vkCmdPipelineBarrier(commandBuffer, blitStage | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, ARRAYSIZE(blitBarriers), blitBarriers);
 
-	Mesh mesh = {};
-	loadMesh(mesh, argv[1], buildMeshlets);
+		// One tile per view layer, left to right
+		VkImageBlit blitRegions[kViewCount] = {};
 
-	Buffer scratch = {};
-	createBuffer(scratch, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		for (uint32_t i = 0; i < kViewCount; ++i)
+		{
+			blitRegions[i].srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blitRegions[i].srcSubresource.baseArrayLayer = i;
+			blitRegions[i].srcSubresource.layerCount = 1;
+			blitRegions[i].srcOffsets[1] = { int32_t(renderWidth), int32_t(renderHeight), 1 };
+			blitRegions[i].dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blitRegions[i].dstSubresource.layerCount = 1;
+			blitRegions[i].dstOffsets[0] = { int32_t(swapchain.width * i / kViewCount), 0, 0 };
+			blitRegions[i].dstOffsets[1] = { int32_t(swapchain.width * (i + 1) / kViewCount), int32_t(swapchain.height), 1 };
+		}
 
-	Buffer vb = {};
-	createBuffer(vb, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	Buffer ib = {};
-	createBuffer(ib, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		bool upscale = renderWidth != swapchain.width / kViewCount || renderHeight != swapchain.height;
 
-#if RTX
-	Buffer mb = {};
-	createBuffer(mb, device, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		vkCmdBlitImage(commandBuffer, colorTarget.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapchain.images[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, kViewCount, blitRegions, upscale ? upscaleFilter : VK_FILTER_NEAREST);
 
-	memcpy(scratch.data, mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet));
-	uploadBuffer(device, queue, commandPool, commandBuffer, scratch, mb, mesh.meshlets.size() * sizeof(Meshlet));
+		VkImageMemoryBarrier presentBarrier = imageBarrier(swapchain.images[imageIndex], VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &presentBarrier);
+#else
+		VkImageMemoryBarrier presentBarrier = imageBarrier(swapchain.images[imageIndex], 0, 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &presentBarrier);
 #endif
 
-	memcpy(scratch.data, mesh.vertices.data(), mesh.vertices.size()  * sizeof(Vertex));
-	uploadBuffer(device, queue, commandPool, commandBuffer, scratch, vb, mesh.vertices.size() * sizeof(Vertex));
+		if (timestampPool)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, 1);
 
-	memcpy(scratch.data, mesh.indices.data(), mesh.indices.size()  * sizeof(uint32_t));
-	uploadBuffer(device, queue, commandPool, commandBuffer, scratch, ib, mesh.indices.size() * sizeof(uint32_t));
+		VK_CHECK(vkEndCommandBuffer(commandBuffer));
+	};
 
-	VkSemaphore acquireSemaphore = createSemaphore(device);
-	assert(acquireSemaphore);
+#if STATIC_COMMANDS
+	// Command buffers reference upload offsets, so they are recorded per upload slot; with CULL_PREPASS the cull slot matches the upload slot
+	static_assert(kUploadSlots % cullSlotCount == 0, "cull slots must follow upload slots");
+	const uint32_t staticSlotCount = kUploadSlots;
 
-	VkSemaphore submitSemaphore = createSemaphore(device);
-	assert(submitSemaphore);
+	// Not transient: these command buffers live until the swapchain or the scene changes
+	VkCommandPool staticCommandPool = createCommandPool(device, familyIndex, 0);
+	assert(staticCommandPool);
 
-	double frameBegin = 0.0;
-	double frameEnd = 0.0;
-	double deltaTime = 0.0;
+	VkCommandBuffer staticCommandBuffers[ARRAYSIZE(swapchain.images)][staticSlotCount] = {};
+	bool staticRecorded[ARRAYSIZE(swapchain.images)][staticSlotCount] = {};
+
+	VkCommandBufferAllocateInfo staticAllocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	staticAllocateInfo.commandBufferCount = ARRAYSIZE(swapchain.images) * staticSlotCount;
+	staticAllocateInfo.commandPool = staticCommandPool;
+	staticAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+	VK_CHECK(vkAllocateCommandBuffers(device, &staticAllocateInfo, &staticCommandBuffers[0][0]));
+#endif
 
 	glfwShowWindow(window);
 
@@ -941,6 +3243,36 @@ int main(int argc, char** argv)
 	{
 		frameBegin = glfwGetTime();
 
+		if (presentConfig.lowLatency && presentId > 0)
+		{
+			// Wait for the previous frame to reach the display so that the input below is sampled as late as possible
+			VkResult waitResult = vkWaitForPresentKHR(device, swapchain.swapchain, presentId, 100000000);
+			assert(waitResult == VK_SUCCESS || waitResult == VK_TIMEOUT || waitResult == VK_ERROR_OUT_OF_DATE_KHR || waitResult == VK_SUBOPTIMAL_KHR);
+
+			if (waitResult == VK_SUCCESS)
+			{
+				latency = glfwGetTime() - inputTimes[presentId % kLatencyHistory];
+
+				latencyMin = latency < latencyMin ? latency : latencyMin;
+				latencyMax = latency > latencyMax ? latency : latencyMax;
+				latencySum += latency;
+				latencyCount++;
+			}
+
+			// With FIFO the next image can't be shown before the next vblank; start the frame just in time for it, leaving some slack for variance
+			if ((presentConfig.presentMode == VK_PRESENT_MODE_FIFO_KHR || presentConfig.presentMode == VK_PRESENT_MODE_FIFO_RELAXED_KHR) && refreshInterval > 0)
+			{
+				double delay = refreshInterval - frameCost * 1.25 - 0.001;
+
+				if (delay > 0)
+					std::this_thread::sleep_for(std::chrono::duration<double>(delay));
+			}
+
+			glfwPollEvents();
+		}
+
+		double workBegin = glfwGetTime();
+
 		{
 			int width, height;
 			glfwGetWindowSize(window, &width, &height);
@@ -951,103 +3283,190 @@ int main(int argc, char** argv)
 				glfwGetWindowSize(window, &width, &height);
 			}
 
-			updateSwapchain(swapchain, device, physicalDevice, surface, surfaceFormat);
+			if (updateSwapchain(swapchain, deletionQueue, device, physicalDevice, surface, surfaceFormat, presentConfig, swapchainDirty))
+			{
+				presentId = 0;
+				swapchainDirty = false;
+
+#if STATIC_COMMANDS
+				// Image views, extent and render targets changed; the previous frame has completed, so none of the recorded command buffers is pending
+				VK_CHECK(vkResetCommandPool(device, staticCommandPool, 0));
+				memset(staticRecorded, 0, sizeof(staticRecorded));
+
+#if CULL_PREPASS
+				memset(cullRecorded, 0, sizeof(cullRecorded));
+#endif
+#endif
+
+				destroyRenderTargets();
+				createRenderTargets(swapchain.width / kViewCount, swapchain.height);
+			}
 		}
 
-		uint32_t imageIndex = 0;
-		VK_CHECK(vkAcquireNextImageKHR(device, swapchain.swapchain, ~0ull, acquireSemaphore, 0, &imageIndex));
+		{
+#if DYNAMIC_RESOLUTION
+			uint32_t width = uint32_t(swapchain.width / kViewCount * renderScale.scale + 0.5f);
+			uint32_t height = uint32_t(swapchain.height * renderScale.scale + 0.5f);
 
-		VK_CHECK(vkResetCommandPool(device, commandPool, 0));
+			width = width ? width : 1;
+			height = height ? height : 1;
+#else
+			uint32_t width = swapchain.width / kViewCount;
+			uint32_t height = swapchain.height;
+#endif
 
-		VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			// Targets grow straight to the swapchain size and shrink only once less than half of them is used, so scale changes rarely reallocate
+			// The previous frame has completed and the cull pass doesn't access render targets, so there is no need to wait for the device
+			if (width > targetWidth || height > targetHeight)
+			{
+				destroyRenderTargets();
+				createRenderTargets(swapchain.width / kViewCount, swapchain.height);
+			}
+			else if (uint64_t(width) * height * 2 < uint64_t(targetWidth) * targetHeight)
+			{
+				destroyRenderTargets();
+				createRenderTargets(width, height);
+			}
 
-		VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+#if STATIC_COMMANDS
+			if (width != renderWidth || height != renderHeight)
+			{
+				VK_CHECK(vkResetCommandPool(device, staticCommandPool, 0));
+				memset(staticRecorded, 0, sizeof(staticRecorded));
 
-		VkRenderingAttachmentInfo colorAttachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.imageView = swapchain.imageViews[imageIndex];
-		colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		colorAttachment.clearValue.color = { 0.1f, 0.1f, 0.15f, 1.0f };
+#if CULL_PREPASS
+				memset(cullRecorded, 0, sizeof(cullRecorded));
+#endif
+			}
+#endif
 
-		VkRenderingInfo passInfo = { VK_STRUCTURE_TYPE_RENDERING_INFO };
-		passInfo.layerCount = 1;
-		passInfo.colorAttachmentCount = 1;
-		passInfo.pColorAttachments = &colorAttachment;
-		passInfo.renderArea.extent = { swapchain.width, swapchain.height };
+			renderWidth = width;
+			renderHeight = height;
+		}
 
-		VkImageMemoryBarrier renderBarrier = imageBarrier(swapchain.images[imageIndex], 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &renderBarrier);
+		// Newly uploaded batches become drawable at frame boundaries; recorded command buffers bake the meshlet and index counts
+#if STATIC_COMMANDS
+		if (streamMesh())
+		{
+			VK_CHECK(vkResetCommandPool(device, staticCommandPool, 0));
+			memset(staticRecorded, 0, sizeof(staticRecorded));
 
-		vkCmdBeginRendering(commandBuffer, &passInfo);
+#if CULL_PREPASS
+			memset(cullRecorded, 0, sizeof(cullRecorded));
+#endif
+		}
+#else
+		streamMesh();
+#endif
 
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+#if CULL_PREPASS
+		uint32_t cullSlot = uint32_t(frameIndex % cullSlotCount);
+#else
+		uint32_t cullSlot = 0;
+#endif
 
-		VkViewport viewport = { 0.0f, 0.0f, float(swapchain.width), float(swapchain.height), 0.0f, 1.0f };
-		VkRect2D scissor = { {0, 0}, {swapchain.width, swapchain.height} };
+		uint32_t imageIndex = 0;
+		VkResult acquireResult = vkAcquireNextImageKHR(device, swapchain.swapchain, ~0ull, acquireSemaphore, 0, &imageIndex);
 
-		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		// Nothing has been submitted for this frame yet and the acquire semaphore is left unsignaled, so the frame restarts on a new swapchain
+		if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			swapchainDirty = true;
+			continue;
+		}
 
-		VkDescriptorBufferInfo vbInfo = {};
-		vbInfo.buffer = vb.buffer;
-		vbInfo.offset = 0;
-		vbInfo.range = vb.size;
+		// Suboptimal images can still be presented; the swapchain is recreated at the start of the next frame
+		assert(acquireResult == VK_SUCCESS || acquireResult == VK_SUBOPTIMAL_KHR);
+		swapchainDirty |= acquireResult == VK_SUBOPTIMAL_KHR;
+
+		// The frame that last used this slot has finished: frames wait for their fence before the next one starts
+		uint32_t uploadSlot = uint32_t(frameIndex % kUploadSlots);
+
+#if UPLOADS
+		beginUploadSlot(uploads, uploadSlot);
+#endif
 
 #if RTX
-		VkDescriptorBufferInfo mbInfo = {};
-		mbInfo.buffer = mb.buffer;
-		mbInfo.offset = 0;
-		mbInfo.range = mb.size;
+		// Allocation order is the same every frame, so command buffers recorded for this slot keep pointing at the current data
+		viewUpload = allocateUpload(uploads, sizeof(views), physicalDeviceProperties.limits.minStorageBufferOffsetAlignment);
+		memcpy(viewUpload.data, views, sizeof(views));
+#endif
 
-		VkWriteDescriptorSet descriptors[2] = {};
-		descriptors[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptors[0].dstBinding = 0;
-		descriptors[0].descriptorCount = 1;
-		descriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptors[0].pBufferInfo = &vbInfo;
-		
-		descriptors[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptors[1].dstBinding = 1;
-		descriptors[1].descriptorCount = 1;
-		descriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptors[1].pBufferInfo = &mbInfo;
-		
-		vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayout, 0, ARRAYSIZE(descriptors), descriptors);
-		
-		vkCmdDrawMeshTasksNV(commandBuffer, uint32_t(mesh.meshlets.size()) / 32, 0);
+#if !CULL_PREPASS && RTX
+		drawUpload = allocateUpload(uploads, sizeof(VkDrawMeshTasksIndirectCommandNV), 4);
+
+		// Batches are whole groups of 32 meshlets, see kStreamBatchMeshlets
+		VkDrawMeshTasksIndirectCommandNV* taskCommand = static_cast<VkDrawMeshTasksIndirectCommandNV*>(drawUpload.data);
+		taskCommand->taskCount = meshStream.readyMeshlets / 32;
+		taskCommand->firstTask = 0;
+#elif !CULL_PREPASS
+		// The chunk count only changes when the mesh is published, which invalidates static command buffers along with the allocation size
+		uint32_t drawCount = meshStream.readyIndices ? uint32_t(mesh.indexChunks.size()) : 0;
+
+		drawUpload = allocateUpload(uploads, drawCount * sizeof(VkDrawIndexedIndirectCommand), 4);
+
+		// 16-bit indices are relative to their chunk, which supplies the base vertex; chunks are clipped to the resident indices
+		VkDrawIndexedIndirectCommand* drawCommands = static_cast<VkDrawIndexedIndirectCommand*>(drawUpload.data);
+
+		for (uint32_t i = 0; i < drawCount; ++i)
+		{
+			const IndexChunk& chunk = mesh.indexChunks[i];
+			uint32_t readyCount = chunk.indexOffset < meshStream.readyIndices ? meshStream.readyIndices - chunk.indexOffset : 0;
+
+			drawCommands[i].indexCount = chunk.indexCount < readyCount ? chunk.indexCount : readyCount;
+			drawCommands[i].instanceCount = 1;
+			drawCommands[i].firstIndex = chunk.indexOffset;
+			drawCommands[i].vertexOffset = int32_t(chunk.vertexOffset);
+			drawCommands[i].firstInstance = 0;
+		}
+#endif
+
+#if STATIC_COMMANDS
+		// Recorded once per swapchain image and upload slot, and again only after the swapchain or the scene changes
+		VkCommandBuffer frameCommandBuffer = staticCommandBuffers[imageIndex][uploadSlot];
+
+		if (!staticRecorded[imageIndex][uploadSlot])
+		{
+			recordFrame(frameCommandBuffer, imageIndex, cullSlot, recordFlags);
+			staticRecorded[imageIndex][uploadSlot] = true;
+		}
 #else
-		VkWriteDescriptorSet descriptors[1] = {};
-		descriptors[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptors[0].dstBinding = 0;
-		descriptors[0].descriptorCount = 1;
-		descriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptors[0].pBufferInfo = &vbInfo;
+		VK_CHECK(vkResetCommandPool(device, commandPool, 0));
 
-		vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayout, 0, ARRAYSIZE(descriptors), descriptors);
-		vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, VK_INDEX_TYPE_UINT32);
+		VkCommandBuffer frameCommandBuffer = commandBuffer;
+		recordFrame(frameCommandBuffer, imageIndex, cullSlot, recordFlags);
+#endif
 
-		vkCmdDrawIndexed(commandBuffer, uint32_t(mesh.indices.size()), 1, 0, 0, 0);
+#if VISBUFFER || OFFSCREEN_COLOR
+		// The swapchain image is only written by the final blit, rendering can start before it is acquired
+		VkPipelineStageFlags acquireStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+#else
+		VkPipelineStageFlags acquireStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 #endif
 
-		vkCmdEndRendering(commandBuffer);
-		
-		VkImageMemoryBarrier presentBarrier = imageBarrier(swapchain.images[imageIndex], 0, 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &presentBarrier);
+#if CULL_PREPASS
+		VkSemaphore waitSemaphores[] = { acquireSemaphore, cullSemaphores[cullSlot] };
+		VkPipelineStageFlags waitStages[] = { acquireStage, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT };
+#else
+		VkSemaphore waitSemaphores[] = { acquireSemaphore };
+		VkPipelineStageFlags waitStages[] = { acquireStage };
+#endif
 
-		VK_CHECK(vkEndCommandBuffer(commandBuffer));
+#if CULL_STATS
+		VkCommandBuffer submitCommandBuffers[] = { frameCommandBuffer, statsCommandBuffers[frameIndex % kCullStatsLatency][cullSlot] };
+#else
+		VkCommandBuffer submitCommandBuffers[] = { frameCommandBuffer };
+#endif
 
-		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 		VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-		submitInfo.pWaitDstStageMask = &waitStage;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-		submitInfo.waitSemaphoreCount = 1;
-		submitInfo.pWaitSemaphores = &acquireSemaphore;
+		submitInfo.pWaitDstStageMask = waitStages;
+		submitInfo.commandBufferCount = ARRAYSIZE(submitCommandBuffers);
+		submitInfo.pCommandBuffers = submitCommandBuffers;
+		submitInfo.waitSemaphoreCount = ARRAYSIZE(waitSemaphores);
+		submitInfo.pWaitSemaphores = waitSemaphores;
 		submitInfo.signalSemaphoreCount = 1;
 		submitInfo.pSignalSemaphores = &submitSemaphore;
-		VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, frameFence));
 
 		VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
 		presentInfo.swapchainCount = 1;
@@ -1055,32 +3474,306 @@ int main(int argc, char** argv)
 		presentInfo.pImageIndices = &imageIndex;
 		presentInfo.waitSemaphoreCount = 1;
 		presentInfo.pWaitSemaphores = &submitSemaphore;
-		VK_CHECK(vkQueuePresentKHR(queue, &presentInfo));
 
-		VK_CHECK(vkDeviceWaitIdle(device));
+		presentId++;
+
+		VkPresentIdKHR presentIdInfo = { VK_STRUCTURE_TYPE_PRESENT_ID_KHR };
+		presentIdInfo.swapchainCount = 1;
+		presentIdInfo.pPresentIds = &presentId;
+
+		if (presentConfig.lowLatency)
+		{
+			presentInfo.pNext = &presentIdInfo;
+			inputTimes[presentId % kLatencyHistory] = workBegin;
+		}
+
+		// The semaphore wait is executed even if the present is rejected as out of date
+		VkResult presentResult = vkQueuePresentKHR(queue, &presentInfo);
+		assert(presentResult == VK_SUCCESS || presentResult == VK_SUBOPTIMAL_KHR || presentResult == VK_ERROR_OUT_OF_DATE_KHR);
+		swapchainDirty |= presentResult != VK_SUCCESS;
+
+		if (frameIndex == 0)
+			printf("First frame in %.2f s\n", glfwGetTime() - loadBegin);
+
+#if RTX || CULL_PREPASS
+		if (meshResident && tuneIndex < tuneCandidates.size())
+		{
+			// Background compiles would compete with the measured frames for CPU time, so measuring starts once every candidate is built
+			if (tuneIndex == 0 && tuneFrame == 0)
+				for (MeshletPipelines& variant : variants)
+					waitPipelines(compiler, variant.pending);
+
+			// GPU times cover the previous frame and its cull, which may overlap on the compute queue; warmup frames absorb the switch to the current candidate
+			if (tuneFrame++ >= kTuneWarmupFrames)
+				tuneTime += gpuTime + cullTime;
+
+			if (tuneFrame == kTuneWarmupFrames + kTuneFrames)
+			{
+				const MeshletConfig& tuned = tuneCandidates[tuneIndex];
+				tuneResults[tuneIndex] = tuneTime / kTuneFrames;
+
+				printf("Autotune %d/%d: %u vertices, %u triangles, mesh workgroup %u, cull workgroup %u, task cull %u: %.3f ms (%d meshlets, %.1f MB allocated)\n", int(tuneIndex + 1), int(tuneCandidates.size()),
+					tuned.maxVertices, tuned.maxTriangles, tuned.meshWorkgroupSize, tuned.cullWorkgroupSize, tuned.taskCull, tuneResults[tuneIndex] * 1000, int(mesh.meshlets.size()), gMemoryStats.total / (1024.0 * 1024.0));
+
+				tuneIndex++;
+				tuneFrame = 0;
+				tuneTime = 0.0;
+
+				size_t nextIndex = tuneIndex;
+
+				if (tuneIndex == tuneCandidates.size())
+				{
+					nextIndex = 0;
+					for (size_t i = 1; i < tuneResults.size(); i++)
+						if (tuneResults[i] < tuneResults[nextIndex])
+							nextIndex = i;
+
+					saveMeshletConfig(kTuneFile, physicalDeviceProperties, tuneCandidates[nextIndex]);
+
+					printf("Autotune picked configuration %d (%.3f ms), saved to %s\n", int(nextIndex + 1), tuneResults[nextIndex] * 1000, kTuneFile);
+
+					dumpMemoryStats(memoryProperties);
+				}
+
+				// The next cull slot has not been submitted yet, so after this wait nothing references the old buffers
+				VK_CHECK(vkDeviceWaitIdle(device));
+
+				meshletConfig = tuneCandidates[nextIndex];
+
+#if STATIC_COMMANDS
+				VK_CHECK(vkResetCommandPool(device, staticCommandPool, 0));
+				memset(staticRecorded, 0, sizeof(staticRecorded));
+
+#if CULL_PREPASS
+				memset(cullRecorded, 0, sizeof(cullRecorded));
+#endif
+#endif
+
+				// Same stages as loadMesh from the same input, so the candidate is measured exactly as a tuned run loads it; meshlet order renumbers (and may duplicate) vertices and index chunks follow meshlet boundaries, so every stream is uploaded again
+				mesh = tuneMesh;
+				buildMeshletData(mesh, meshletConfig.maxVertices, meshletConfig.maxTriangles);
+
+				assert(mesh.meshlets.size() <= meshletCapacity);
+				assert(meshStream.indexCount == mesh.indices.size());
+				assert(mesh.positions.size() * sizeof(VertexPosition) <= vb.size && mesh.attributes.size() * sizeof(VertexAttributes) <= ab.size);
+
+				indexType = mesh.indices16.empty() ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+
+				memcpy(scratch.data, mesh.positions.data(), mesh.positions.size() * sizeof(VertexPosition));
+				uploadBuffer(device, queue, commandPool, commandBuffer, scratch, vb, mesh.positions.size() * sizeof(VertexPosition));
+
+				memcpy(scratch.data, mesh.attributes.data(), mesh.attributes.size() * sizeof(VertexAttributes));
+				uploadBuffer(device, queue, commandPool, commandBuffer, scratch, ab, mesh.attributes.size() * sizeof(VertexAttributes));
+
+				if (indexType == VK_INDEX_TYPE_UINT16)
+				{
+					memcpy(scratch.data, mesh.indices16.data(), mesh.indices16.size() * sizeof(uint16_t));
+					uploadBuffer(device, queue, commandPool, commandBuffer, scratch, ib, mesh.indices16.size() * sizeof(uint16_t));
+				}
+				else
+				{
+					memcpy(scratch.data, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+					uploadBuffer(device, queue, commandPool, commandBuffer, scratch, ib, mesh.indices.size() * sizeof(uint32_t));
+				}
+
+				memcpy(scratch.data, mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet));
+				uploadBuffer(device, queue, commandPool, commandBuffer, scratch, mb, mesh.meshlets.size() * sizeof(Meshlet));
+
+				meshStream.meshletCount = uint32_t(mesh.meshlets.size());
+				meshStream.readyMeshlets = uint32_t(mesh.meshlets.size());
+				meshStream.vertexCount = uint32_t(mesh.positions.size());
+
+				// Every candidate keeps its pipelines until exit
+				meshPipeline = variants[nextIndex].mesh;
+				visPipeline = variants[nextIndex].vis;
+				cullPipeline = variants[nextIndex].cull;
+			}
+		}
+#endif
+
+#if CULL_PREPASS
+		// The other slot was last consumed by the previous frame, which has completed by now
+		uint32_t nextCullSlot = uint32_t((frameIndex + 1) % cullSlotCount);
+
+		cullData.viewportWidth = float(renderWidth);
+		cullData.viewportHeight = float(renderHeight);
+		cullData.meshletCount = meshStream.readyMeshlets;
+
+		if (!STATIC_COMMANDS || !cullRecorded[nextCullSlot])
+		{
+			recordCull(device, cullCommandPools[nextCullSlot], cullCommandBuffers[nextCullSlot], recordFlags, cullPipeline, cullLayout, meshletConfig.cullWorkgroupSize, mb, dcb[nextCullSlot], mlb[nextCullSlot], dib[nextCullSlot], slb[nextCullSlot], csb[nextCullSlot], cullData, timestampPool, 2 + 2 * nextCullSlot);
+			cullRecorded[nextCullSlot] = true;
+		}
+
+		submitCull(computeQueue, cullCommandBuffers[nextCullSlot], cullSemaphores[nextCullSlot]);
+#endif
+
+		VK_CHECK(vkWaitForFences(device, 1, &frameFence, VK_TRUE, ~0ull));
+		VK_CHECK(vkResetFences(device, 1, &frameFence));
+
+		advanceDeletionQueue(deletionQueue);
+
+#if CULL_STATS
+		// The oldest readback slot, about to be reused by the next frame
+		if (frameIndex + 1 >= kCullStatsLatency)
+			memcpy(&cullStats, static_cast<char*>(statsReadback.data) + (frameIndex + 1) % kCullStatsLatency * sizeof(CullStats), sizeof(CullStats));
+#endif
+
+		frameIndex++;
+
+		if (timestampPool)
+		{
+			uint64_t timestamps[2] = {};
+			VK_CHECK(vkGetQueryPoolResults(device, timestampPool, 0, ARRAYSIZE(timestamps), sizeof(timestamps), timestamps, sizeof(timestamps[0]), VK_QUERY_RESULT_64_BIT));
+
+			gpuTime = double(timestamps[1] - timestamps[0]) * physicalDeviceProperties.limits.timestampPeriod * 1e-9;
 
-		glfwPollEvents();
+#if CULL_PREPASS
+			// The frame waited for this slot's cull, so its queries are available too
+			uint64_t cullTimestamps[2] = {};
+			VK_CHECK(vkGetQueryPoolResults(device, timestampPool, 2 + 2 * cullSlot, ARRAYSIZE(cullTimestamps), sizeof(cullTimestamps), cullTimestamps, sizeof(cullTimestamps[0]), VK_QUERY_RESULT_64_BIT));
+
+			cullTime = double(cullTimestamps[1] - cullTimestamps[0]) * physicalDeviceProperties.limits.timestampPeriod * 1e-9;
+#endif
+
+#if DYNAMIC_RESOLUTION
+			updateRenderScale(renderScale, gpuTime);
+#endif
+		}
+
+		// Time from input sampling to GPU completion, smoothed to absorb spikes when pacing the next frame
+		frameCost = frameCost * 0.9 + (glfwGetTime() - workBegin) * 0.1;
+
+		// Low latency mode polls right before the next frame starts
+		if (!presentConfig.lowLatency)
+			glfwPollEvents();
+
+		updateMemoryBudget(physicalDevice);
+
+		// M prints the memory report
+		bool memoryKey = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+
+		if (memoryKey && !memoryKeyDown)
+			dumpMemoryStats(memoryProperties);
+
+		memoryKeyDown = memoryKey;
 
 		frameEnd = glfwGetTime();
 		deltaTime = frameEnd - frameBegin;
 
-		static char title[256] = {};
-		snprintf(title, sizeof(title), "Yosemite | Frame time: %.2fms | Triangles: %lld | Meshlets: %lld", deltaTime * 1000, mesh.indices.size() / 3, mesh.meshlets.size());
+		static char title[512] = {};
+		snprintf(title, sizeof(title), "Yosemite | Frame time: %.2fms | Latency: %.2fms | Triangles: %lld | Meshlets: %lld | Memory: %.0fMB", deltaTime * 1000, latency * 1000, (long long)meshStream.readyIndices / 3, (long long)meshStream.readyMeshlets, gMemoryStats.total / (1024.0 * 1024.0));
+
+#if CULL_STATS
+		size_t statsLength = strlen(title);
+		snprintf(title + statsLength, sizeof(title) - statsLength, " | Culled: %u cone, %u frustum of %u | SW: %u | Drawn: %u tris",
+			cullStats.meshletsConeCulled, cullStats.meshletsFrustumCulled, cullStats.meshletsTested, cullStats.meshletsSoftware, cullStats.trianglesEmitted);
+#endif
+
+#if DYNAMIC_RESOLUTION
+		size_t titleLength = strlen(title);
+		snprintf(title + titleLength, sizeof(title) - titleLength, " | GPU: %.2fms | Scale: %d%%", gpuTime * 1000, int(renderScale.scale * 100 + 0.5f));
+#endif
+
 		glfwSetWindowTitle(window, title);
 	}
 
+	VK_CHECK(vkDeviceWaitIdle(device));
+
+	// Drops the pipelines that haven't started compiling; the cache keeps everything compiled so far for the next run
+	destroyPipelineCompiler(compiler);
+	savePipelineCache(device, pipelineCache, kPipelineCacheFile);
+
+#if ASYNC_LOAD
+	// The window may be closed before preprocessing has finished
+	if (loader.joinable())
+		loader.join();
+#endif
+
+	destroyMeshStream(device, meshStream);
+
+	if (latencyCount)
+		printf("Input to present latency: min %.2fms, avg %.2fms, max %.2fms over %lld frames\n", latencyMin * 1000, latencySum / latencyCount * 1000, latencyMax * 1000, (long long)latencyCount);
+
+#if STATIC_COMMANDS
+	vkDestroyCommandPool(device, staticCommandPool, 0);
+#endif
+
+	vkDestroyQueryPool(device, timestampPool, 0);
+
+#if CULL_STATS
+	vkDestroyCommandPool(device, statsCommandPool, 0);
+	destroyBuffer(device, statsReadback);
+#endif
+
+	for (uint32_t i = 0; i < cullSlotCount; i++)
+		destroyBuffer(device, csb[i]);
+
+	vkDestroyFence(device, frameFence, 0);
 	vkDestroySemaphore(device, submitSemaphore, 0);
 	vkDestroySemaphore(device, acquireSemaphore, 0);
 
-#if RTX
+#if CULL_PREPASS
+	for (uint32_t i = 0; i < cullSlotCount; i++)
+	{
+		vkDestroySemaphore(device, cullSemaphores[i], 0);
+		vkFreeCommandBuffers(device, cullCommandPools[i], 1, &cullCommandBuffers[i]);
+		vkDestroyCommandPool(device, cullCommandPools[i], 0);
+
+		destroyBuffer(device, slb[i]);
+		destroyBuffer(device, dib[i]);
+		destroyBuffer(device, mlb[i]);
+		destroyBuffer(device, dcb[i]);
+	}
+#endif
+
+#if RTX || CULL_PREPASS
 	destroyBuffer(device, mb);
 #endif
 
+#if UPLOADS
+	destroyUploadAllocator(device, uploads);
+#endif
+
 	destroyBuffer(device, ib);
+	destroyBuffer(device, ab);
 	destroyBuffer(device, vb);
 	destroyBuffer(device, scratch);
 
-	vkDestroyPipeline(device, meshPipeline, 0);
+#if SWRASTER
+	vkDestroyPipeline(device, rasterPipeline, 0);
+	vkDestroyPipelineLayout(device, rasterLayout, 0);
+	vkDestroyDescriptorSetLayout(device, rasterSetLayout, 0);
+	vkDestroyShaderModule(device, rasterShader, 0);
+#endif
+
+	// Also destroys the targets retired just above and any swapchains still waiting for their presents
+	destroyRenderTargets();
+	flushDeletionQueue(deletionQueue);
+
+#if VISBUFFER
+	vkDestroyPipeline(device, resolvePipeline, 0);
+	vkDestroyPipelineLayout(device, resolveLayout, 0);
+	vkDestroyDescriptorSetLayout(device, resolveSetLayout, 0);
+	vkDestroyShaderModule(device, resolveShader, 0);
+
+	vkDestroyShaderModule(device, visFragShader, 0);
+	vkDestroyShaderModule(device, visVertShader, 0);
+#endif
+
+	for (MeshletPipelines& variant : variants)
+	{
+		vkDestroyPipeline(device, variant.cull, 0);
+		vkDestroyPipeline(device, variant.vis, 0);
+		vkDestroyPipeline(device, variant.mesh, 0);
+	}
+
+#if CULL_PREPASS
+	vkDestroyPipelineLayout(device, cullLayout, 0);
+	vkDestroyDescriptorSetLayout(device, cullSetLayout, 0);
+	vkDestroyShaderModule(device, cullShader, 0);
+#endif
+
 	vkDestroyPipelineLayout(device, meshLayout, 0);
 	vkDestroyDescriptorSetLayout(device, meshSetLayout, 0);
 	vkDestroyShaderModule(device, meshFragShader, 0);
@@ -1098,6 +3791,9 @@ int main(int argc, char** argv)
 	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 	vkDestroyCommandPool(device, commandPool, 0);
 
+	vkDestroyPipelineCache(device, pipelineCache, 0);
+	destroyShaderRegistry(shaders);
+
 	vkDestroyDevice(device, 0);
 
 #ifdef _DEBUG
@@ -0,0 +1,476 @@
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "geometry.h"
+#include "scene.h"
+
+// Benchmarks the CPU mesh preprocessing stages from geometry.cpp without touching Vulkan.
+// Prints one JSON object per line (stage, mesh, triangle count, timing, memory) so that results can be diffed over time.
+
+// Stages allocate from WorkerPool threads too; relaxed atomics are enough since only the totals matter
+static std::atomic<size_t> gHeapCurrent(0);
+static std::atomic<size_t> gHeapPeak(0);
+
+// Allocation header keeps the returned pointer aligned to __STDCPP_DEFAULT_NEW_ALIGNMENT__
+static const size_t kHeapHeader = 16;
+
+void* operator new(size_t size)
+{
+	void* ptr = malloc(size + kHeapHeader);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	*static_cast<size_t*>(ptr) = size;
+
+	size_t current = gHeapCurrent.fetch_add(size, std::memory_order_relaxed) + size;
+	size_t peak = gHeapPeak.load(std::memory_order_relaxed);
+
+	while (peak < current && !gHeapPeak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {}
+
+	return static_cast<char*>(ptr) + kHeapHeader;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if (!ptr)
+		return;
+
+	char* base = static_cast<char*>(ptr) - kHeapHeader;
+
+	gHeapCurrent.fetch_sub(*reinterpret_cast<size_t*>(base), std::memory_order_relaxed);
+
+	free(base);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	operator delete(ptr);
+}
+
+size_t getProcessPeakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+	return counters.PeakWorkingSetSize;
+#elif defined(__APPLE__)
+	rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
+
+	return size_t(usage.ru_maxrss);
+#else
+	rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
+
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+double getTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Flat-shaded triangle soup, same layout as loadObj output so that remapMesh has duplicates to weld
+void generateGrid(std::vector<Vertex>& vertices, size_t triangleCount)
+{
+	size_t size = std::max(size_t(sqrt(double(triangleCount) / 2)), size_t(1));
+
+	vertices.clear();
+	vertices.reserve(size * size * 6);
+
+	for (size_t y = 0; y < size; ++y)
+		for (size_t x = 0; x < size; ++x)
+		{
+			float x0 = float(x) / size * 2 - 1, x1 = float(x + 1) / size * 2 - 1;
+			float y0 = float(y) / size * 2 - 1, y1 = float(y + 1) / size * 2 - 1;
+
+			Vertex v00 = { x0, y0, 0, 0, 0, 1, float(x) / size, float(y) / size };
+			Vertex v10 = { x1, y0, 0, 0, 0, 1, float(x + 1) / size, float(y) / size };
+			Vertex v01 = { x0, y1, 0, 0, 0, 1, float(x) / size, float(y + 1) / size };
+			Vertex v11 = { x1, y1, 0, 0, 0, 1, float(x + 1) / size, float(y + 1) / size };
+
+			vertices.push_back(v00);
+			vertices.push_back(v10);
+			vertices.push_back(v11);
+			vertices.push_back(v00);
+			vertices.push_back(v11);
+			vertices.push_back(v01);
+		}
+}
+
+Vertex sphereVertex(size_t ring, size_t segment, size_t rings, size_t segments)
+{
+	const float kPi = 3.14159265f;
+
+	float theta = float(ring) / rings * kPi;
+	float phi = float(segment) / segments * 2 * kPi;
+
+	float nx = sinf(theta) * cosf(phi);
+	float ny = cosf(theta);
+	float nz = sinf(theta) * sinf(phi);
+
+	return { nx * 0.5f, ny * 0.5f, nz * 0.5f, nx, ny, nz, float(segment) / segments, float(ring) / rings };
+}
+
+void generateSphere(std::vector<Vertex>& vertices, size_t triangleCount)
+{
+	// UV sphere with twice as many segments as rings: 2 * rings * segments triangles
+	size_t rings = std::max(size_t(sqrt(double(triangleCount) / 4)), size_t(2));
+	size_t segments = rings * 2;
+
+	vertices.clear();
+	vertices.reserve(rings * segments * 6);
+
+	for (size_t r = 0; r < rings; ++r)
+		for (size_t s = 0; s < segments; ++s)
+		{
+			Vertex v00 = sphereVertex(r, s, rings, segments);
+			Vertex v10 = sphereVertex(r, s + 1, rings, segments);
+			Vertex v01 = sphereVertex(r + 1, s, rings, segments);
+			Vertex v11 = sphereVertex(r + 1, s + 1, rings, segments);
+
+			vertices.push_back(v00);
+			vertices.push_back(v11);
+			vertices.push_back(v10);
+			vertices.push_back(v00);
+			vertices.push_back(v01);
+			vertices.push_back(v11);
+		}
+}
+
+struct StageResult
+{
+	double seconds; // fastest run
+	size_t heapPeak; // bytes allocated on top of what was live when the stage started
+};
+
+// Runs the stage until minTime has passed (at least once, at most maxRuns times); reset restores the stage input
+template <typename Reset, typename Stage>
+StageResult measure(Reset reset, Stage stage, double minTime, int maxRuns)
+{
+	StageResult result = { 1e30, 0 };
+	double total = 0;
+
+	for (int run = 0; run < maxRuns && (run == 0 || total < minTime); ++run)
+	{
+		reset();
+
+		size_t heapBase = gHeapCurrent.load();
+		gHeapPeak.store(heapBase);
+
+		double start = getTime();
+		stage();
+		double elapsed = getTime() - start;
+
+		result.seconds = std::min(result.seconds, elapsed);
+		result.heapPeak = std::max(result.heapPeak, gHeapPeak.load() - heapBase);
+
+		total += elapsed;
+	}
+
+	return result;
+}
+
+void report(const char* mesh, const char* stage, size_t triangles, const StageResult& result, const char* unit = "triangles")
+{
+	printf("{\"mesh\": \"%s\", \"stage\": \"%s\", \"%s\": %zu, \"seconds\": %.6f, \"%sPerSecond\": %.0f, \"heapPeakBytes\": %zu, \"processPeakBytes\": %zu}\n",
+		mesh, stage, unit, triangles, result.seconds, unit, double(triangles) / result.seconds, result.heapPeak, getProcessPeakMemory());
+	fflush(stdout);
+}
+
+// Validation failures go to stderr so that stdout stays one JSON object per line; main exits with 1 if there were any
+static int gValidationErrors = 0;
+
+void reportError(const char* mesh, const char* stage, const char* message, size_t index)
+{
+	fprintf(stderr, "%s: %s: %s (at %zu)\n", mesh, stage, message, index);
+	gValidationErrors++;
+}
+
+static bool nearlyEqual(float expected, float actual)
+{
+	return fabsf(expected - actual) <= 1e-4f * std::max(1.f, fabsf(expected));
+}
+
+// SIMD kernels accumulate in a different order than the scalar one, so their output only has to match within a tolerance
+void validateCones(const char* name, const char* stage, const std::vector<Meshlet>& expected, const std::vector<MeshletBounds>& expectedBounds, const Mesh& mesh)
+{
+	for (size_t i = 0; i < expected.size(); ++i)
+	{
+		const Meshlet& em = expected[i];
+		const Meshlet& am = mesh.meshlets[i];
+
+		// The cone cutoff is sqrt(1 - d^2) of the minimum dot product, which amplifies rounding when all normals agree, so its square is compared
+		// A cutoff of 1 disables the cone; the axis is then irrelevant, and normals spread that wide nearly cancel out in the sum it is normalized from
+		bool disabled = em.cone[3] >= 1.f && am.cone[3] >= 1.f;
+		bool axis = nearlyEqual(em.cone[0], am.cone[0]) && nearlyEqual(em.cone[1], am.cone[1]) && nearlyEqual(em.cone[2], am.cone[2]);
+		bool cone = (disabled || axis) && nearlyEqual(em.cone[3] * em.cone[3], am.cone[3] * am.cone[3]);
+		bool sphere = nearlyEqual(em.center[0], am.center[0]) && nearlyEqual(em.center[1], am.center[1]) && nearlyEqual(em.center[2], am.center[2]) && nearlyEqual(em.radius, am.radius);
+
+		if (!cone || !sphere)
+			return reportError(name, stage, cone ? "bounding sphere differs from scalar" : "cone differs from scalar", i);
+
+		for (int k = 0; k < 3; ++k)
+			if (!nearlyEqual(expectedBounds[i].min[k], mesh.meshletBounds[i].min[k]) || !nearlyEqual(expectedBounds[i].max[k], mesh.meshletBounds[i].max[k]))
+				return reportError(name, stage, "bounds differ from scalar", i);
+	}
+}
+
+// Chunks cover the indices in order, each 16-bit index plus the chunk base vertex gives the 32-bit index, and every meshlet lies in one chunk whose base vertex it carries
+void validateIndexChunks(const char* name, const Mesh& mesh)
+{
+	// optimizeMeshletOrder numbers vertices in 64K windows, so meshlet meshes of any size must get 16-bit indices
+	if (!mesh.meshlets.empty() && mesh.indices16.empty())
+		return reportError(name, "chunks", "meshlet mesh fell back to 32-bit indices", mesh.positions.size());
+
+	if (mesh.indices16.empty())
+		return;
+
+	if (mesh.indices16.size() != mesh.indices.size())
+		return reportError(name, "chunks", "16-bit index count differs", mesh.indices16.size());
+
+	size_t indexOffset = 0;
+
+	for (size_t i = 0; i < mesh.indexChunks.size(); ++i)
+	{
+		const IndexChunk& chunk = mesh.indexChunks[i];
+
+		if (chunk.indexOffset != indexOffset)
+			return reportError(name, "chunks", "chunk doesn't start where the previous one ends", i);
+
+		for (size_t j = chunk.indexOffset; j < chunk.indexOffset + chunk.indexCount; ++j)
+			if (mesh.indices16[j] + chunk.vertexOffset != mesh.indices[j])
+				return reportError(name, "chunks", "16-bit index plus vertexOffset differs from the 32-bit index", j);
+
+		indexOffset += chunk.indexCount;
+	}
+
+	if (indexOffset != mesh.indices.size())
+		return reportError(name, "chunks", "chunks don't cover all indices", indexOffset);
+
+	size_t chunkIndex = 0;
+
+	for (size_t i = 0; i < mesh.meshlets.size() && mesh.meshlets[i].triangleCount; ++i)
+	{
+		const Meshlet& meshlet = mesh.meshlets[i];
+
+		while (chunkIndex < mesh.indexChunks.size() && mesh.indexChunks[chunkIndex].indexOffset + mesh.indexChunks[chunkIndex].indexCount <= meshlet.indexOffset)
+			chunkIndex++;
+
+		if (chunkIndex == mesh.indexChunks.size() || meshlet.indexOffset + meshlet.triangleCount * 3 > mesh.indexChunks[chunkIndex].indexOffset + mesh.indexChunks[chunkIndex].indexCount)
+			return reportError(name, "chunks", "meshlet spans several chunks", i);
+
+		if (meshlet.vertexOffset != mesh.indexChunks[chunkIndex].vertexOffset)
+			return reportError(name, "chunks", "meshlet vertexOffset differs from its chunk", i);
+	}
+}
+
+void benchmarkStages(const char* name, const std::vector<Vertex>& triangleVertices, double minTime, int maxRuns)
+{
+	size_t triangles = triangleVertices.size() / 3;
+
+	Mesh mesh;
+
+	report(name, "remap", triangles, measure([&]() { mesh = Mesh(); }, [&]() { remapMesh(mesh, triangleVertices); }, minTime, maxRuns));
+
+	// optimizeMesh works in place, so every run starts from a freshly remapped copy
+	Mesh remapped = mesh;
+
+	report(name, "optimize", triangles, measure([&]() { mesh = remapped; }, [&]() { optimizeMesh(mesh); }, minTime, maxRuns));
+
+	remapped = Mesh();
+
+	report(name, "meshlets", triangles, measure([&]() { mesh.meshlets.clear(); mesh.meshlets.shrink_to_fit(); }, [&]() { buildMeshlets(mesh); }, minTime, maxRuns));
+
+	// Every kernel the CPU supports, so the SIMD paths can be compared against the scalar fallback
+	const char* coneStages[] = { "cones_scalar", "cones_sse", "cones_avx2" };
+
+	std::vector<Meshlet> scalarMeshlets;
+	std::vector<MeshletBounds> scalarBounds;
+
+	for (int level = SimdLevel_Scalar; level <= getSimdLevel(); ++level)
+	{
+		report(name, coneStages[level], triangles, measure([]() {}, [&]() { buildMeshletCones(mesh, SimdLevel(level)); }, minTime, maxRuns));
+
+		if (level == SimdLevel_Scalar)
+		{
+			scalarMeshlets = mesh.meshlets;
+			scalarBounds = mesh.meshletBounds;
+		}
+		else
+			validateCones(name, coneStages[level], scalarMeshlets, scalarBounds, mesh);
+	}
+
+	scalarMeshlets = std::vector<Meshlet>();
+	scalarBounds = std::vector<MeshletBounds>();
+
+	// optimizeMeshletOrder works in place as well; every run starts from the cone builder output
+	Mesh built = mesh;
+
+	report(name, "meshlet_order", triangles, measure([&]() { mesh = built; }, [&]() { optimizeMeshletOrder(mesh); }, minTime, maxRuns));
+
+	built = Mesh();
+
+	report(name, "chunks", triangles, measure([]() {}, [&]() { buildIndexChunks(mesh); }, minTime, maxRuns));
+
+	validateIndexChunks(name, mesh);
+}
+
+// Random boxes in a 1000 unit cube, a few units across, like instances of small props scattered over a large scene
+void generateInstances(std::vector<Aabb>& bounds, size_t count, unsigned int seed)
+{
+	bounds.resize(count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		float v[4];
+
+		for (int k = 0; k < 4; ++k)
+		{
+			seed = seed * 1664525 + 1013904223;
+			v[k] = float(seed >> 8) / float(1 << 24);
+		}
+
+		float x = v[0] * 1000, y = v[1] * 1000, z = v[2] * 1000;
+		float r = 0.5f + v[3] * 4;
+
+		bounds[i] = { { x - r, y - r, z - r }, { x + r, y + r, z + r } };
+	}
+}
+
+void benchmarkScene(size_t instanceCount, unsigned int threadCount, double minTime, int maxRuns)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "instances%zu", instanceCount);
+
+	std::vector<Aabb> bounds;
+	generateInstances(bounds, instanceCount, 42);
+
+	WorkerPool* pool = createWorkerPool(threadCount);
+
+	InstanceBvh bvh;
+
+	report(name, "bvh_build_serial", instanceCount, measure([]() {}, [&]() { buildInstanceBvh(bvh, bounds, 0); }, minTime, maxRuns), "instances");
+	report(name, "bvh_build_parallel", instanceCount, measure([]() {}, [&]() { buildInstanceBvh(bvh, bounds, pool); }, minTime, maxRuns), "instances");
+
+	report(name, "bvh_refit", instanceCount, measure([]() {}, [&]() { refitInstanceBvh(bvh, bounds); }, minTime, maxRuns), "instances");
+
+	// 1% of the instances move each frame
+	std::vector<uint32_t> moved;
+
+	for (size_t i = 0; i < instanceCount; i += 100)
+		moved.push_back(uint32_t(i));
+
+	report(name, "bvh_refit_moved", instanceCount, measure([]() {}, [&]() { refitInstanceBvh(bvh, bounds, moved); }, minTime, maxRuns), "instances");
+
+	// 90 degree frustum at a corner of the scene looking along the XZ diagonal, covering the lower half in Y
+	const float kDiagonal = 0.70710678f;
+
+	float planes[6][4] =
+	{
+		{ 1, 0, 0, 0 },
+		{ 0, 0, 1, 0 },
+		{ 0, 1, 0, 0 },
+		{ 0, -1, 0, 500 },
+		{ kDiagonal, 0, kDiagonal, -10 * kDiagonal },
+		{ -kDiagonal, 0, -kDiagonal, 1000 * kDiagonal },
+	};
+
+	std::vector<uint32_t> visible;
+
+	const char* cullStages[] = { "bvh_cull_scalar", "bvh_cull_sse" };
+
+	// The box test has no AVX2 variant, six planes already fit in two SSE vectors
+	for (int level = SimdLevel_Scalar; level <= std::min(getSimdLevel(), SimdLevel_SSE); ++level)
+		report(name, cullStages[level], instanceCount, measure([]() {}, [&]() { cullInstanceBvh(visible, bvh, bounds, planes, SimdLevel(level), pool); }, minTime, maxRuns), "instances");
+
+	destroyWorkerPool(pool);
+}
+
+int main(int argc, char** argv)
+{
+	const char* objPath = "data/kitten.obj";
+	size_t maxTriangles = 10000000;
+	double minTime = 0.5;
+	int maxRuns = 10;
+	size_t maxInstances = 1000000;
+	unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--obj") == 0 && i + 1 < argc)
+			objPath = argv[++i];
+		else if (strcmp(argv[i], "--max-triangles") == 0 && i + 1 < argc)
+			maxTriangles = strtoull(argv[++i], 0, 10);
+		else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+			minTime = atof(argv[++i]);
+		else if (strcmp(argv[i], "--max-runs") == 0 && i + 1 < argc)
+			maxRuns = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--max-instances") == 0 && i + 1 < argc)
+			maxInstances = strtoull(argv[++i], 0, 10);
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			threadCount = unsigned(atoi(argv[++i]));
+		else
+		{
+			fprintf(stderr, "Usage: %s [--obj <obj_file>] [--max-triangles <count>] [--min-time <seconds>] [--max-runs <count>] [--max-instances <count>] [--threads <worker_count>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<Vertex> triangleVertices;
+
+	StageResult load = measure([&]() { triangleVertices.clear(); triangleVertices.shrink_to_fit(); }, [&]() { loadObj(triangleVertices, objPath); }, minTime, maxRuns);
+	report(objPath, "loadObj", triangleVertices.size() / 3, load);
+
+	benchmarkStages(objPath, triangleVertices, minTime, maxRuns);
+
+	// 180,901 vertices after welding, more than one 64K window; checked regardless of --max-triangles since meshlet ordering used to push such meshes to 32-bit indices
+	{
+		Mesh sphere;
+
+		generateSphere(triangleVertices, 360000);
+		remapMesh(sphere, triangleVertices);
+		optimizeMesh(sphere);
+		buildMeshletData(sphere, kMeshletMaxVertices, kMeshletMaxTriangles);
+
+		validateIndexChunks("sphere360000", sphere);
+	}
+
+	for (size_t triangles = 10000; triangles <= maxTriangles; triangles *= 10)
+	{
+		char name[64];
+
+		generateGrid(triangleVertices, triangles);
+		snprintf(name, sizeof(name), "grid%zu", triangles);
+		benchmarkStages(name, triangleVertices, minTime, maxRuns);
+
+		generateSphere(triangleVertices, triangles);
+		snprintf(name, sizeof(name), "sphere%zu", triangles);
+		benchmarkStages(name, triangleVertices, minTime, maxRuns);
+	}
+
+	for (size_t instances = 10000; instances <= maxInstances; instances *= 10)
+		benchmarkScene(instances, threadCount, minTime, maxRuns);
+
+	return gValidationErrors ? 1 : 0;
+}
@@ -0,0 +1,660 @@
+#include "scene.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Ranges this small always become leaves; up to kBvhMaxLeafSize the SAH decides
+const size_t kBvhLeafSize = 4;
+const size_t kBvhMaxLeafSize = 16;
+const int kBvhBins = 16;
+
+// Subtrees are handed to workers once they are this small (or smaller than an even share of the instances)
+const size_t kBvhSubtreeSize = 4096;
+
+struct WorkerPool
+{
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	const std::function<void(size_t)>* task;
+	size_t taskCount;
+	std::atomic<size_t> nextTask;
+
+	uint64_t generation;
+	size_t activeThreads;
+	bool quit;
+};
+
+static void executeTasks(WorkerPool* pool)
+{
+	for (size_t i = pool->nextTask.fetch_add(1); i < pool->taskCount; i = pool->nextTask.fetch_add(1))
+		(*pool->task)(i);
+}
+
+static void workerMain(WorkerPool* pool)
+{
+	uint64_t generation = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->wake.wait(lock, [&]() { return pool->quit || pool->generation != generation; });
+
+			if (pool->quit)
+				return;
+
+			generation = pool->generation;
+		}
+
+		executeTasks(pool);
+
+		std::lock_guard<std::mutex> lock(pool->mutex);
+
+		if (--pool->activeThreads == 0)
+			pool->done.notify_one();
+	}
+}
+
+WorkerPool* createWorkerPool(unsigned int threadCount)
+{
+	WorkerPool* pool = new WorkerPool();
+	pool->task = 0;
+	pool->taskCount = 0;
+	pool->nextTask = 0;
+	pool->generation = 0;
+	pool->activeThreads = 0;
+	pool->quit = false;
+
+	for (unsigned int i = 0; i < threadCount; ++i)
+		pool->threads.emplace_back(workerMain, pool);
+
+	return pool;
+}
+
+void destroyWorkerPool(WorkerPool* pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->quit = true;
+	}
+
+	pool->wake.notify_all();
+
+	for (std::thread& thread : pool->threads)
+		thread.join();
+
+	delete pool;
+}
+
+unsigned int getWorkerCount(const WorkerPool* pool)
+{
+	return pool ? unsigned(pool->threads.size()) : 0;
+}
+
+void runTasks(WorkerPool* pool, size_t count, const std::function<void(size_t)>& task)
+{
+	if (!pool || pool->threads.empty() || count <= 1)
+	{
+		for (size_t i = 0; i < count; ++i)
+			task(i);
+
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+
+		pool->task = &task;
+		pool->taskCount = count;
+		pool->nextTask = 0;
+		pool->activeThreads = pool->threads.size();
+		pool->generation++;
+	}
+
+	pool->wake.notify_all();
+
+	executeTasks(pool);
+
+	// Every worker has to check in before the next generation starts, even if the calling thread ran all tasks
+	std::unique_lock<std::mutex> lock(pool->mutex);
+	pool->done.wait(lock, [&]() { return pool->activeThreads == 0; });
+
+	pool->task = 0;
+}
+
+static void mergeBounds(float min[3], float max[3], const float bmin[3], const float bmax[3])
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		min[k] = std::min(min[k], bmin[k]);
+		max[k] = std::max(max[k], bmax[k]);
+	}
+}
+
+// Half of the surface area, which is all the SAH needs
+static float surfaceArea(const float min[3], const float max[3])
+{
+	float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+
+	return dx * dy + dy * dz + dz * dx;
+}
+
+struct BvhSubtree
+{
+	uint32_t node;
+	uint32_t begin;
+	uint32_t end;
+};
+
+// Bounds are copied next to the instance index so that partitioning keeps every pass over a range sequential in memory
+struct BvhItem
+{
+	float min[3];
+	float max[3];
+	float centroid[3];
+	uint32_t instance;
+};
+
+struct BvhBuilder
+{
+	BvhItem* items;
+
+	std::vector<BvhNode>* nodes;
+
+	// Ranges no larger than subtreeSize are recorded here instead of being built; null while building a subtree
+	std::vector<BvhSubtree>* subtrees;
+	size_t subtreeSize;
+};
+
+struct BvhBin
+{
+	float min[3];
+	float max[3];
+	uint32_t count;
+};
+
+static void buildNode(BvhBuilder& builder, uint32_t nodeIndex, uint32_t begin, uint32_t end)
+{
+	std::vector<BvhNode>& nodes = *builder.nodes;
+
+	BvhNode node = nodes[nodeIndex];
+	node.child = 0;
+	node.first = begin;
+	node.count = end - begin;
+
+	float cmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float cmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (int k = 0; k < 3; ++k)
+	{
+		node.min[k] = FLT_MAX;
+		node.max[k] = -FLT_MAX;
+	}
+
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		const BvhItem& item = builder.items[i];
+
+		mergeBounds(node.min, node.max, item.min, item.max);
+		mergeBounds(cmin, cmax, item.centroid, item.centroid);
+	}
+
+	nodes[nodeIndex] = node;
+
+	if (node.count <= kBvhLeafSize)
+		return;
+
+	if (builder.subtrees && node.count <= builder.subtreeSize)
+	{
+		BvhSubtree subtree = { nodeIndex, begin, end };
+		builder.subtrees->push_back(subtree);
+		return;
+	}
+
+	// Binned SAH along the axis with the largest centroid extent; the split goes between bins bestBin - 1 and bestBin
+	int bestAxis = -1;
+	int bestBin = 0;
+	float bestCost = FLT_MAX;
+
+	int axis = (cmax[0] - cmin[0] >= cmax[1] - cmin[1]) ? 0 : 1;
+	axis = (cmax[axis] - cmin[axis] >= cmax[2] - cmin[2]) ? axis : 2;
+
+	float extent = cmax[axis] - cmin[axis];
+
+	if (extent > 0.f)
+	{
+
+		float scale = kBvhBins / extent;
+
+		BvhBin bins[kBvhBins];
+
+		for (int b = 0; b < kBvhBins; ++b)
+			bins[b] = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX }, 0 };
+
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const BvhItem& item = builder.items[i];
+			int b = std::min(int((item.centroid[axis] - cmin[axis]) * scale), kBvhBins - 1);
+
+			mergeBounds(bins[b].min, bins[b].max, item.min, item.max);
+			bins[b].count++;
+		}
+
+		float rightArea[kBvhBins] = {};
+		uint32_t rightCount[kBvhBins] = {};
+
+		float rmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float rmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		uint32_t rcount = 0;
+
+		for (int b = kBvhBins - 1; b > 0; --b)
+		{
+			mergeBounds(rmin, rmax, bins[b].min, bins[b].max);
+			rcount += bins[b].count;
+
+			rightArea[b] = rcount ? surfaceArea(rmin, rmax) : 0.f;
+			rightCount[b] = rcount;
+		}
+
+		float lmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float lmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		uint32_t lcount = 0;
+
+		for (int b = 1; b < kBvhBins; ++b)
+		{
+			mergeBounds(lmin, lmax, bins[b - 1].min, bins[b - 1].max);
+			lcount += bins[b - 1].count;
+
+			if (lcount == 0 || rightCount[b] == 0)
+				continue;
+
+			float cost = surfaceArea(lmin, lmax) * lcount + rightArea[b] * rightCount[b];
+
+			if (cost < bestCost)
+			{
+				bestAxis = axis;
+				bestBin = b;
+				bestCost = cost;
+			}
+		}
+	}
+
+	if (node.count <= kBvhMaxLeafSize && (bestAxis < 0 || bestCost >= surfaceArea(node.min, node.max) * node.count))
+		return;
+
+	BvhItem* split = 0;
+
+	if (bestAxis >= 0)
+	{
+		float scale = kBvhBins / (cmax[bestAxis] - cmin[bestAxis]);
+
+		split = std::partition(builder.items + begin, builder.items + end, [&](const BvhItem& item)
+		{
+			return std::min(int((item.centroid[bestAxis] - cmin[bestAxis]) * scale), kBvhBins - 1) < bestBin;
+		});
+	}
+	else
+	{
+		// All centroids coincide, so any even split is as good as another
+		split = builder.items + begin + node.count / 2;
+	}
+
+	uint32_t mid = uint32_t(split - builder.items);
+	assert(mid > begin && mid < end);
+
+	uint32_t child = uint32_t(nodes.size());
+
+	BvhNode childNode = {};
+	childNode.parent = nodeIndex;
+
+	nodes.push_back(childNode);
+	nodes.push_back(childNode);
+
+	nodes[nodeIndex].child = child;
+
+	buildNode(builder, child + 0, begin, mid);
+	buildNode(builder, child + 1, mid, end);
+}
+
+void buildInstanceBvh(InstanceBvh& bvh, const std::vector<Aabb>& bounds, WorkerPool* pool)
+{
+	size_t count = bounds.size();
+
+	bvh.nodes.clear();
+	bvh.instances.resize(count);
+	bvh.leaves.resize(count);
+
+	if (count == 0)
+		return;
+
+	std::vector<BvhItem> items(count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		BvhItem& item = items[i];
+
+		for (int k = 0; k < 3; ++k)
+		{
+			item.min[k] = bounds[i].min[k];
+			item.max[k] = bounds[i].max[k];
+			item.centroid[k] = (bounds[i].min[k] + bounds[i].max[k]) * 0.5f;
+		}
+
+		item.instance = uint32_t(i);
+	}
+
+	std::vector<BvhSubtree> subtrees;
+
+	BvhBuilder builder = {};
+	builder.items = items.data();
+	builder.nodes = &bvh.nodes;
+	builder.subtrees = pool ? &subtrees : 0;
+	builder.subtreeSize = std::max(count / ((getWorkerCount(pool) + 1) * 4), kBvhSubtreeSize);
+
+	bvh.nodes.push_back(BvhNode());
+	buildNode(builder, 0, 0, uint32_t(count));
+
+	// Subtrees cover disjoint instance ranges, so they can be built independently and appended afterwards
+	std::vector<std::vector<BvhNode>> subtreeNodes(subtrees.size());
+
+	runTasks(pool, subtrees.size(), [&](size_t i)
+	{
+		BvhBuilder local = builder;
+		local.nodes = &subtreeNodes[i];
+		local.subtrees = 0;
+
+		subtreeNodes[i].push_back(BvhNode());
+		buildNode(local, 0, subtrees[i].begin, subtrees[i].end);
+	});
+
+	for (size_t i = 0; i < subtrees.size(); ++i)
+	{
+		const std::vector<BvhNode>& local = subtreeNodes[i];
+
+		// Local node 0 replaces the placeholder, the rest are appended with their links rebased
+		uint32_t root = subtrees[i].node;
+		uint32_t base = uint32_t(bvh.nodes.size()) - 1;
+
+		uint32_t parent = bvh.nodes[root].parent;
+		bvh.nodes[root] = local[0];
+		bvh.nodes[root].parent = parent;
+
+		if (local[0].child)
+			bvh.nodes[root].child = base + local[0].child;
+
+		for (size_t j = 1; j < local.size(); ++j)
+		{
+			BvhNode node = local[j];
+			node.child = node.child ? base + node.child : 0;
+			node.parent = node.parent ? base + node.parent : root;
+
+			bvh.nodes.push_back(node);
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		bvh.instances[i] = items[i].instance;
+
+	for (uint32_t ni = 0; ni < bvh.nodes.size(); ++ni)
+	{
+		const BvhNode& node = bvh.nodes[ni];
+
+		if (node.child == 0)
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+				bvh.leaves[bvh.instances[i]] = ni;
+	}
+}
+
+static void refitNode(InstanceBvh& bvh, const std::vector<Aabb>& bounds, uint32_t ni)
+{
+	BvhNode& node = bvh.nodes[ni];
+
+	for (int k = 0; k < 3; ++k)
+	{
+		node.min[k] = FLT_MAX;
+		node.max[k] = -FLT_MAX;
+	}
+
+	if (node.child)
+	{
+		mergeBounds(node.min, node.max, bvh.nodes[node.child + 0].min, bvh.nodes[node.child + 0].max);
+		mergeBounds(node.min, node.max, bvh.nodes[node.child + 1].min, bvh.nodes[node.child + 1].max);
+	}
+	else
+	{
+		for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			mergeBounds(node.min, node.max, bounds[bvh.instances[i]].min, bounds[bvh.instances[i]].max);
+	}
+}
+
+void refitInstanceBvh(InstanceBvh& bvh, const std::vector<Aabb>& bounds)
+{
+	assert(bounds.size() == bvh.instances.size());
+
+	for (size_t ni = bvh.nodes.size(); ni > 0; --ni)
+		refitNode(bvh, bounds, uint32_t(ni - 1));
+}
+
+void refitInstanceBvh(InstanceBvh& bvh, const std::vector<Aabb>& bounds, const std::vector<uint32_t>& moved)
+{
+	assert(bounds.size() == bvh.instances.size());
+
+	if (bvh.nodes.empty())
+		return;
+
+	std::vector<uint8_t> dirty(bvh.nodes.size(), 0);
+	std::vector<uint32_t> nodes;
+
+	for (uint32_t instance : moved)
+	{
+		// Paths from different instances merge quickly, so each walk stops at the first node that is already queued
+		for (uint32_t ni = bvh.leaves[instance]; !dirty[ni]; ni = bvh.nodes[ni].parent)
+		{
+			dirty[ni] = 1;
+			nodes.push_back(ni);
+
+			if (ni == 0)
+				break;
+		}
+	}
+
+	// Children are stored after their parents
+	std::sort(nodes.begin(), nodes.end(), [](uint32_t l, uint32_t r) { return l > r; });
+
+	for (uint32_t ni : nodes)
+		refitNode(bvh, bounds, ni);
+}
+
+enum CullResult
+{
+	Cull_Outside,
+	Cull_Intersect,
+	Cull_Inside,
+};
+
+// Planes in SoA form with absolute normals precomputed; lanes 6 and 7 hold a plane every box is inside of
+struct FrustumPlanes
+{
+	alignas(16) float nx[8];
+	alignas(16) float ny[8];
+	alignas(16) float nz[8];
+	alignas(16) float nw[8];
+	alignas(16) float ax[8];
+	alignas(16) float ay[8];
+	alignas(16) float az[8];
+};
+
+static void prepareFrustum(FrustumPlanes& frustum, const float planes[6][4])
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		const float* plane = planes[std::min(i, 5)];
+		bool pad = i >= 6;
+
+		frustum.nx[i] = pad ? 0.f : plane[0];
+		frustum.ny[i] = pad ? 0.f : plane[1];
+		frustum.nz[i] = pad ? 0.f : plane[2];
+		frustum.nw[i] = pad ? 1.f : plane[3];
+		frustum.ax[i] = fabsf(frustum.nx[i]);
+		frustum.ay[i] = fabsf(frustum.ny[i]);
+		frustum.az[i] = fabsf(frustum.nz[i]);
+	}
+}
+
+// Center/extent form: the box is outside a plane if the center is further away than the projected extent, and inside if it is nearer
+static CullResult testBoxScalar(const FrustumPlanes& frustum, const float min[3], const float max[3])
+{
+	float cx = (min[0] + max[0]) * 0.5f, cy = (min[1] + max[1]) * 0.5f, cz = (min[2] + max[2]) * 0.5f;
+	float ex = (max[0] - min[0]) * 0.5f, ey = (max[1] - min[1]) * 0.5f, ez = (max[2] - min[2]) * 0.5f;
+
+	CullResult result = Cull_Inside;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		float d = frustum.nx[i] * cx + frustum.ny[i] * cy + frustum.nz[i] * cz + frustum.nw[i];
+		float r = frustum.ax[i] * ex + frustum.ay[i] * ey + frustum.az[i] * ez;
+
+		if (d + r < 0.f)
+			return Cull_Outside;
+
+		if (d - r < 0.f)
+			result = Cull_Intersect;
+	}
+
+	return result;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+// SSE2 only; all six planes are tested in two vectors
+static CullResult testBoxSSE(const FrustumPlanes& frustum, const float min[3], const float max[3])
+{
+	__m128 cx = _mm_set1_ps((min[0] + max[0]) * 0.5f), cy = _mm_set1_ps((min[1] + max[1]) * 0.5f), cz = _mm_set1_ps((min[2] + max[2]) * 0.5f);
+	__m128 ex = _mm_set1_ps((max[0] - min[0]) * 0.5f), ey = _mm_set1_ps((max[1] - min[1]) * 0.5f), ez = _mm_set1_ps((max[2] - min[2]) * 0.5f);
+
+	int outside = 0, intersect = 0;
+
+	for (int i = 0; i < 8; i += 4)
+	{
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(&frustum.nx[i]), cx), _mm_mul_ps(_mm_load_ps(&frustum.ny[i]), cy)), _mm_add_ps(_mm_mul_ps(_mm_load_ps(&frustum.nz[i]), cz), _mm_load_ps(&frustum.nw[i])));
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(&frustum.ax[i]), ex), _mm_mul_ps(_mm_load_ps(&frustum.ay[i]), ey)), _mm_mul_ps(_mm_load_ps(&frustum.az[i]), ez));
+
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+		intersect |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(d, r), _mm_setzero_ps()));
+	}
+
+	return outside ? Cull_Outside : intersect ? Cull_Intersect : Cull_Inside;
+}
+#endif
+
+static CullResult testBox(const FrustumPlanes& frustum, const float min[3], const float max[3], SimdLevel level)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	// Six planes fit in two SSE vectors, so AVX2 has nothing to add here
+	if (level != SimdLevel_Scalar)
+		return testBoxSSE(frustum, min, max);
+#endif
+
+	return testBoxScalar(frustum, min, max);
+}
+
+static void cullSubtree(std::vector<uint32_t>& visible, const InstanceBvh& bvh, const std::vector<Aabb>& bounds, const FrustumPlanes& frustum, SimdLevel level, uint32_t root)
+{
+	std::vector<uint32_t> stack(1, root);
+
+	while (!stack.empty())
+	{
+		const BvhNode& node = bvh.nodes[stack.back()];
+		stack.pop_back();
+
+		CullResult result = testBox(frustum, node.min, node.max, level);
+
+		if (result == Cull_Outside)
+			continue;
+
+		// Fully visible subtrees cover a contiguous range of instances
+		if (result == Cull_Inside)
+		{
+			visible.insert(visible.end(), bvh.instances.begin() + node.first, bvh.instances.begin() + node.first + node.count);
+			continue;
+		}
+
+		if (node.child)
+		{
+			// Right child first so that the left subtree is emitted first and the output stays in leaf order
+			stack.push_back(node.child + 1);
+			stack.push_back(node.child + 0);
+			continue;
+		}
+
+		for (uint32_t i = node.first; i < node.first + node.count; ++i)
+		{
+			uint32_t instance = bvh.instances[i];
+
+			if (testBox(frustum, bounds[instance].min, bounds[instance].max, level) != Cull_Outside)
+				visible.push_back(instance);
+		}
+	}
+}
+
+void cullInstanceBvh(std::vector<uint32_t>& visible, const InstanceBvh& bvh, const std::vector<Aabb>& bounds, const float planes[6][4], SimdLevel level, WorkerPool* pool)
+{
+	visible.clear();
+
+	if (bvh.nodes.empty())
+		return;
+
+	FrustumPlanes frustum;
+	prepareFrustum(frustum, planes);
+
+	// The top of the tree is expanded breadth-first (without culling, subtrees retest their roots) until there are a few subtrees per thread
+	size_t target = pool ? size_t(getWorkerCount(pool) + 1) * 4 : 1;
+
+	std::vector<uint32_t> frontier(1, 0);
+	std::vector<uint32_t> next;
+
+	while (frontier.size() < target)
+	{
+		next.clear();
+
+		for (uint32_t ni : frontier)
+		{
+			if (bvh.nodes[ni].child)
+			{
+				next.push_back(bvh.nodes[ni].child + 0);
+				next.push_back(bvh.nodes[ni].child + 1);
+			}
+			else
+				next.push_back(ni);
+		}
+
+		if (next.size() == frontier.size())
+			break;
+
+		frontier.swap(next);
+	}
+
+	std::vector<std::vector<uint32_t>> outputs(frontier.size());
+
+	runTasks(pool, frontier.size(), [&](size_t i)
+	{
+		cullSubtree(outputs[i], bvh, bounds, frustum, level, frontier[i]);
+	});
+
+	for (const std::vector<uint32_t>& output : outputs)
+		visible.insert(visible.end(), output.begin(), output.end());
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+#include "geometry.h"
+
+// World-space bounds of one instance
+struct Aabb
+{
+	float min[3];
+	float max[3];
+};
+
+// Binary BVH over instance bounds; children are adjacent and always stored after their parent, so a reverse pass over nodes is bottom-up
+struct BvhNode
+{
+	float min[3];
+	uint32_t child; // index of the first of two children, 0 for leaves (the root is never a child)
+	float max[3];
+	uint32_t parent;
+	uint32_t first; // range of InstanceBvh::instances covered by the subtree
+	uint32_t count;
+};
+
+struct InstanceBvh
+{
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> instances; // instance indices in leaf order
+	std::vector<uint32_t> leaves; // leaf node of every instance, used by incremental refits
+};
+
+// Persistent worker threads; the thread calling runTasks works on tasks too
+struct WorkerPool;
+
+WorkerPool* createWorkerPool(unsigned int threadCount);
+void destroyWorkerPool(WorkerPool* pool);
+unsigned int getWorkerCount(const WorkerPool* pool);
+
+// Calls task(i) for every i in [0, count) and returns once all calls have finished; runs serially when pool is null
+void runTasks(WorkerPool* pool, size_t count, const std::function<void(size_t)>& task);
+
+// Binned SAH build; subtrees below the top levels are built on the pool
+void buildInstanceBvh(InstanceBvh& bvh, const std::vector<Aabb>& bounds, WorkerPool* pool);
+
+// Recomputes every node from the instance bounds; the tree topology is kept, so quality degrades as instances move far from where they were at build time
+void refitInstanceBvh(InstanceBvh& bvh, const std::vector<Aabb>& bounds);
+
+// Only updates the nodes on the paths from the moved instances to the root
+void refitInstanceBvh(InstanceBvh& bvh, const std::vector<Aabb>& bounds, const std::vector<uint32_t>& moved);
+
+// Writes the indices of instances that intersect the frustum (planes are inside when dot(xyz, p) + w >= 0) in leaf order
+void cullInstanceBvh(std::vector<uint32_t>& visible, const InstanceBvh& bvh, const std::vector<Aabb>& bounds, const float planes[6][4], SimdLevel level, WorkerPool* pool);
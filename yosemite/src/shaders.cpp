@@ -0,0 +1,129 @@
+#include "shaders.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const uint32_t kSpirvMagic = 0x07230203;
+
+// Magic, version, generator, bound and schema
+const size_t kSpirvHeaderSize = 5 * sizeof(uint32_t);
+
+const void* mapFile(const char* path, size_t& size)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return 0;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	CloseHandle(file);
+
+	if (!mapping)
+		return 0;
+
+	// The view keeps the mapping alive
+	const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+
+	size = size_t(fileSize.QuadPart);
+	return data;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+		return 0;
+
+	struct stat info = {};
+	if (fstat(file, &info) < 0 || info.st_size == 0)
+	{
+		close(file);
+		return 0;
+	}
+
+	void* data = mmap(0, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+
+	if (data == MAP_FAILED)
+		return 0;
+
+	size = size_t(info.st_size);
+	return data;
+#endif
+}
+
+void unmapFile(const void* data, size_t size)
+{
+#ifdef _WIN32
+	(void)size;
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<void*>(data), size);
+#endif
+}
+
+void addShaderDirectory(ShaderRegistry& registry, const char* path)
+{
+	registry.directories.push_back(path);
+}
+
+void destroyShaderRegistry(ShaderRegistry& registry)
+{
+	for (ShaderFile& file : registry.files)
+		unmapFile(file.code, file.size);
+
+	registry.files.clear();
+}
+
+const ShaderFile* findShader(ShaderRegistry& registry, const char* name)
+{
+	for (const ShaderFile& file : registry.files)
+		if (file.name == name)
+			return &file;
+
+	for (const std::string& directory : registry.directories)
+	{
+		std::string path = directory + "/" + name + ".spv";
+
+		size_t size = 0;
+		const void* data = mapFile(path.c_str(), size);
+
+		if (!data)
+			continue;
+
+		// Mappings are page aligned, so the code can be passed to the driver as is
+		if (size < kSpirvHeaderSize || size % 4 != 0 || *static_cast<const uint32_t*>(data) != kSpirvMagic)
+		{
+			unmapFile(data, size);
+			continue;
+		}
+
+		ShaderFile file;
+		file.name = name;
+		file.path = path;
+		file.code = static_cast<const uint32_t*>(data);
+		file.size = size;
+
+		registry.files.push_back(file);
+
+		return &registry.files.back();
+	}
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Read-only file mapping; returns 0 if the file can't be opened or is empty
+const void* mapFile(const char* path, size_t& size);
+void unmapFile(const void* data, size_t size);
+
+// Compiled SPIR-V, mapped straight from disk
+struct ShaderFile
+{
+	std::string name;
+	std::string path;
+
+	const uint32_t* code;
+	size_t size; // in bytes
+};
+
+// Finds shaders by name (e.g. "meshlet.task" for meshlet.task.spv) in the first directory that has them; files stay mapped until the registry is destroyed
+struct ShaderRegistry
+{
+	std::vector<std::string> directories;
+	std::vector<ShaderFile> files;
+};
+
+void addShaderDirectory(ShaderRegistry& registry, const char* path);
+void destroyShaderRegistry(ShaderRegistry& registry);
+
+// Returns 0 if no directory has a valid SPIR-V module with this name; the result is valid until the next call
+const ShaderFile* findShader(ShaderRegistry& registry, const char* name);
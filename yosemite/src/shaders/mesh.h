@@ -2,9 +2,14 @@
 #ifndef MESH_H_
 #define MESH_H_ 1
 
-struct Vertex
+// Vertex streams, see VertexPosition/VertexAttributes in geometry.h
+struct VertexPosition
 {
 	float vx, vy, vz;
+};
+
+struct VertexAttributes
+{
 	float nx, ny, nz;
 	float tu, tv;
 };
@@ -12,10 +17,68 @@ struct Vertex
 struct Meshlet
 {
 	vec4 cone;
+	vec3 center;
+	float radius;
 	uint32_t vertices[64];
 	uint32_t indicesPacked[124*3/4];
+	uint32_t indexOffset;
+	uint32_t vertexOffset;
 	uint8_t triangleCount;
 	uint8_t vertexCount;
 };
 
+// Debug counters updated by meshletcull.comp and meshlet.task when CULL_STATS is specialized on, see CullStats in main.cpp
+struct CullStats
+{
+	uint32_t meshletsTested;
+	uint32_t meshletsConeCulled;
+	uint32_t meshletsFrustumCulled;
+	uint32_t meshletsSoftware;
+	uint32_t trianglesEmitted;
+};
+
+// One camera of a multiview pass, see View in main.cpp
+struct View
+{
+	mat4 transform; // world to clip
+	vec4 direction; // world-space viewing direction used for cone culling
+	vec4 planes[6]; // world-space frustum planes, xyz normalized, inside when dot(xyz, p) + w >= 0
+};
+
+struct MeshTaskCommand
+{
+	uint32_t taskCount;
+	uint32_t firstTask;
+};
+
+struct DrawIndexedCommand
+{
+	uint32_t indexCount;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;
+};
+
+struct DispatchCommand
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t z;
+};
+
+// Shaders that enable GL_KHR_shader_subgroup_ballot define MESH_SUBGROUP_BALLOT before including this file
+#ifdef MESH_SUBGROUP_BALLOT
+// Sum of an 8-bit value over the subgroup with one ballot per bit, so that the counters only need ballot support
+uint ballotSum8(uint value)
+{
+	uint sum = 0;
+
+	for (uint i = 0; i < 8; ++i)
+		sum += subgroupBallotBitCount(subgroupBallot((value & (1u << i)) != 0)) << i;
+
+	return sum;
+}
+#endif
+
 #endif
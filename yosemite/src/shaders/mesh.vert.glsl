@@ -7,20 +7,26 @@
 
 #include "mesh.h"
 
-layout(binding = 0) readonly buffer Vertices
+layout(binding = 0) readonly buffer Positions
 {
-	Vertex vertices[];
+	VertexPosition positions[];
+};
+
+layout(binding = 5) readonly buffer Attributes
+{
+	VertexAttributes attributes[];
 };
 
 layout(location = 0) out vec4 vColor;
 
 void main()
 {
-	Vertex v = vertices[gl_VertexIndex];
+	VertexPosition v = positions[gl_VertexIndex];
+	VertexAttributes a = attributes[gl_VertexIndex];
 
 	vec3 position = vec3(v.vx, -v.vy, v.vz * 0.5 + 0.5);
-	vec3 normal = vec3(v.nx, v.ny, v.nz);
-	vec2 texcoord = vec2(v.tu, v.tv);
+	vec3 normal = vec3(a.nx, a.ny, a.nz);
+	vec2 texcoord = vec2(a.tu, a.tv);
 
 	gl_Position = vec4(position, 1.0);
 	
@@ -0,0 +1,19 @@
+#version 460
+
+// Fixed-function counterpart of mesh.vert: the same two vertex streams are bound as vertex buffers instead of being pulled from storage buffers
+layout(location = 0) in vec3 vPosition;
+layout(location = 1) in vec3 vNormal;
+layout(location = 2) in vec2 vTexCoord;
+
+layout(location = 0) out vec4 vColor;
+
+void main()
+{
+	vec3 position = vec3(vPosition.x, -vPosition.y, vPosition.z * 0.5 + 0.5);
+	vec3 normal = vNormal;
+	vec2 texcoord = vTexCoord;
+
+	gl_Position = vec4(position, 1.0);
+	
+	vColor = vec4(normal * 0.5 + 0.5, 1.0);
+}
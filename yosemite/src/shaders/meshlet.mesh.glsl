@@ -8,12 +8,13 @@
 
 #include "mesh.h"
 
-layout(local_size_x = 32) in;
+// Workgroup size is specialized per device (MeshletConfig::meshWorkgroupSize); output limits match kMeshletMaxVertices/kMeshletMaxTriangles
+layout(local_size_x = 32, local_size_x_id = 2) in;
 layout(triangles, max_vertices = 64, max_primitives = 124) out;
 
-layout(binding = 0) readonly buffer Vertices
+layout(binding = 0) readonly buffer Positions
 {
-	Vertex vertices[];
+	VertexPosition positions[];
 };
 
 layout(binding = 1) readonly buffer Meshlets
@@ -21,9 +22,15 @@ layout(binding = 1) readonly buffer Meshlets
 	Meshlet meshlets[];
 };
 
+layout(binding = 5) readonly buffer Attributes
+{
+	VertexAttributes attributes[];
+};
+
 in taskNV block
 {
 	uint32_t meshletIndices[32];
+	uint32_t viewMasks[32]; // only written for multiview, see meshletview.mesh
 };
 
 layout(location = 0) out vec4 vColor[];
@@ -37,13 +44,13 @@ void main()
 	uint triangleCount = meshlets[mi].triangleCount;
 	uint indexCount = triangleCount * 3;
 
-	for (uint i = ti; i < vertexCount; i += 3)
+	for (uint i = ti; i < vertexCount; i += gl_WorkGroupSize.x)
 	{
 		uint vi = meshlets[mi].vertices[i];
 
-		vec3 position = vec3(vertices[vi].vx, -vertices[vi].vy, vertices[vi].vz * 0.5 + 0.5);
-		vec3 normal = vec3(vertices[vi].nx, vertices[vi].ny, vertices[vi].nz);
-		vec2 texcoord = vec2(vertices[vi].tu, vertices[vi].tv);
+		vec3 position = vec3(positions[vi].vx, -positions[vi].vy, positions[vi].vz * 0.5 + 0.5);
+		vec3 normal = vec3(attributes[vi].nx, attributes[vi].ny, attributes[vi].nz);
+		vec2 texcoord = vec2(attributes[vi].tu, attributes[vi].tv);
 
 		gl_MeshVerticesNV[i].gl_Position = vec4(position, 1.0);
 	
@@ -52,7 +59,7 @@ void main()
 
 	uint indexGroupCount = (indexCount + 3) / 4;
 
-	for (uint i = ti; i < indexGroupCount; i += 32)
+	for (uint i = ti; i < indexGroupCount; i += gl_WorkGroupSize.x)
 	{
 		writePackedPrimitiveIndices4x8NV(i * 4, meshlets[mi].indicesPacked[i]);
 	}
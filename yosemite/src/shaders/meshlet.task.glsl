@@ -6,11 +6,16 @@
 
 #extension GL_GOOGLE_include_directive : require
 
+#extension GL_KHR_shader_subgroup_basic: require
 #extension GL_KHR_shader_subgroup_ballot: require
 
+#define MESH_SUBGROUP_BALLOT 1
 #include "mesh.h"
 
-#define CULL 1
+layout(constant_id = 0) const bool CULL_PREPASS = false;
+layout(constant_id = 1) const bool TASK_CULL = true;
+layout(constant_id = 4) const bool CULL_STATS = false;
+layout(constant_id = 5) const uint VIEW_COUNT = 1;
 
 layout(local_size_x = 32) in;
 
@@ -19,9 +24,31 @@ layout(binding = 1) readonly buffer Meshlets
 	Meshlet meshlets[];
 };
 
+layout(binding = 2) readonly buffer DrawCounts
+{
+	MeshTaskCommand taskCommand;
+	uint32_t visibleCount;
+};
+
+layout(binding = 3) readonly buffer MeshletList
+{
+	uint32_t meshletList[];
+};
+
+layout(binding = 6) buffer Stats
+{
+	CullStats stats;
+};
+
+layout(binding = 7) readonly buffer Views
+{
+	View views[];
+};
+
 out taskNV block
 {
 	uint32_t meshletIndices[32];
+	uint32_t viewMasks[32]; // bit per view that the meshlet is visible in
 };
 
 shared uint meshletCount;
@@ -31,29 +58,119 @@ bool coneCull(vec4 cone, vec3 view)
 	return dot(cone.xyz, view) > cone.w;
 }
 
+bool frustumCull(View view, vec3 center, float radius)
+{
+	for (int i = 0; i < 6; ++i)
+		if (dot(view.planes[i].xyz, center) + view.planes[i].w < -radius)
+			return true;
+
+	return false;
+}
+
+// With CULL_PREPASS the counters are updated by meshletcull.comp instead; one elected invocation per subgroup adds the subgroup's counts
+void countStats(uint mi, bool coneCulled, bool frustumCulled)
+{
+	bool tested = meshlets[mi].triangleCount > 0;
+	bool accept = tested && !coneCulled && !frustumCulled;
+
+	uint testedCount = subgroupBallotBitCount(subgroupBallot(tested));
+	uint coneCount = subgroupBallotBitCount(subgroupBallot(tested && coneCulled));
+	uint frustumCount = subgroupBallotBitCount(subgroupBallot(tested && frustumCulled));
+	uint triangleCount = ballotSum8(accept ? uint(meshlets[mi].triangleCount) : 0);
+
+	if (subgroupElect())
+	{
+		atomicAdd(stats.meshletsTested, testedCount);
+		atomicAdd(stats.meshletsConeCulled, coneCount);
+		atomicAdd(stats.meshletsFrustumCulled, frustumCount);
+		atomicAdd(stats.trianglesEmitted, triangleCount);
+	}
+}
+
 void main()
 {
 	uint ti = gl_LocalInvocationID.x;
 	uint mgi = gl_WorkGroupID.x;
 	uint mi = mgi * 32 + ti;
 
-#if CULL
-	bool accept = !coneCull(meshlets[mi].cone, vec3(0, 0, -1));
-	uvec4 ballot = subgroupBallot(accept);
+	// Meshlets were already culled and compacted by meshletcull.comp
+	if (CULL_PREPASS)
+	{
+		uint count = min(visibleCount - mgi * 32, 32u);
+
+		if (ti < count)
+			meshletIndices[ti] = meshletList[mi];
+
+		if (ti == 0)
+			gl_TaskCountNV = count;
+
+		return;
+	}
+
+	// Every view is tested here so that the mesh shader fetches the meshlet once and only rasterizes it in the views it is visible in
+	if (VIEW_COUNT > 1)
+	{
+		uint coneMask = 0; // views that the meshlet faces
+		uint mask = 0;
+
+		for (uint i = 0; i < VIEW_COUNT; ++i)
+			if (!coneCull(meshlets[mi].cone, views[i].direction.xyz))
+			{
+				coneMask |= 1 << i;
+
+				if (!frustumCull(views[i], meshlets[mi].center, meshlets[mi].radius))
+					mask |= 1 << i;
+			}
+
+		bool accept = meshlets[mi].triangleCount > 0 && mask != 0;
+		uvec4 ballot = subgroupBallot(accept);
+
+		uint index = subgroupBallotExclusiveBitCount(ballot);
+
+		if (accept)
+		{
+			meshletIndices[index] = mi;
+			viewMasks[index] = mask;
+		}
+
+		uint count = subgroupBallotBitCount(ballot);
+
+		if (ti == 0)
+			gl_TaskCountNV = count;
+
+		// Rejections count as cone culled when the meshlet faces away from every view, like the cone test coming first in meshletcull.comp
+		if (CULL_STATS)
+			countStats(mi, coneMask == 0, coneMask != 0 && mask == 0);
+
+		return;
+	}
+
+	if (TASK_CULL)
+	{
+		bool accept = !coneCull(meshlets[mi].cone, vec3(0, 0, -1));
+		uvec4 ballot = subgroupBallot(accept);
+
+		uint index = subgroupBallotExclusiveBitCount(ballot);
+
+		if (accept)
+			meshletIndices[index] = mi;
 
-	uint index = subgroupBallotExclusiveBitCount(ballot);
+		uint count = subgroupBallotBitCount(ballot);
 
-	if (accept)
-		meshletIndices[index] = mi;
+		if (ti == 0)
+			gl_TaskCountNV = count;
 
-	uint count = subgroupBallotBitCount(ballot);
+		if (CULL_STATS)
+			countStats(mi, !accept, false);
+	}
+	else
+	{
+		meshletIndices[ti] = mi;
 
-	if (ti == 0)
-		gl_TaskCountNV = count;
-#else
-	meshletIndices[ti] = mi;
+		if (ti == 0)
+			gl_TaskCountNV = 32;
 
-	if (ti == 0)
-		gl_TaskCountNV = 32;
-#endif
+		if (CULL_STATS)
+			countStats(mi, false, false);
+	}
 }
@@ -0,0 +1,143 @@
+
+#version 460
+
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+
+#extension GL_GOOGLE_include_directive : require
+
+#extension GL_KHR_shader_subgroup_basic: require
+#extension GL_KHR_shader_subgroup_ballot: require
+
+#define MESH_SUBGROUP_BALLOT 1
+#include "mesh.h"
+
+layout(constant_id = 4) const bool CULL_STATS = false;
+
+layout(local_size_x = 32, local_size_x_id = 3) in;
+
+layout(push_constant) uniform block
+{
+	uint meshletCount;
+	float softwareThreshold;
+	vec2 viewportSize;
+};
+
+layout(binding = 0) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+layout(binding = 1) buffer DrawCounts
+{
+	MeshTaskCommand taskCommand;
+	uint32_t visibleCount;
+	DispatchCommand softwareCommand;
+};
+
+layout(binding = 2) writeonly buffer MeshletList
+{
+	uint32_t meshletList[];
+};
+
+layout(binding = 3) writeonly buffer DrawCommands
+{
+	DrawIndexedCommand drawCommands[];
+};
+
+layout(binding = 4) writeonly buffer SoftwareList
+{
+	uint32_t softwareList[];
+};
+
+layout(binding = 5) buffer Stats
+{
+	CullStats stats;
+};
+
+bool coneCull(vec4 cone, vec3 view)
+{
+	return dot(cone.xyz, view) > cone.w;
+}
+
+bool frustumCull(vec3 center, float radius)
+{
+	// Same transform as the geometry stages: x and y map to [-1, 1], z maps to [0, 1] at half scale
+	vec3 c = vec3(center.x, -center.y, center.z * 0.5 + 0.5);
+	vec3 r = vec3(radius, radius, radius * 0.5);
+
+	return any(lessThan(c + r, vec3(-1, -1, 0))) || any(greaterThan(c - r, vec3(1, 1, 1)));
+}
+
+void main()
+{
+	uint mi = gl_GlobalInvocationID.x;
+
+	bool tested = mi < meshletCount && meshlets[mi].triangleCount > 0;
+	bool coneCulled = tested && coneCull(meshlets[mi].cone, vec3(0, 0, -1));
+	bool frustumCulled = tested && !coneCulled && frustumCull(meshlets[mi].center, meshlets[mi].radius);
+
+	bool visible = tested && !coneCulled && !frustumCulled;
+
+	// Projected diameter in pixels; small meshlets are cheaper to rasterize in meshletraster.comp
+	bool software = visible && meshlets[mi].radius * max(viewportSize.x, viewportSize.y) < softwareThreshold;
+	bool accept = visible && !software;
+
+	uvec4 softwareBallot = subgroupBallot(software);
+	uint softwareCount = subgroupBallotBitCount(softwareBallot);
+
+	uint softwareBase = 0;
+
+	if (subgroupElect() && softwareCount > 0)
+		softwareBase = atomicAdd(softwareCommand.x, softwareCount);
+
+	softwareBase = subgroupBroadcastFirst(softwareBase);
+
+	if (software)
+		softwareList[softwareBase + subgroupBallotExclusiveBitCount(softwareBallot)] = mi;
+
+	uvec4 ballot = subgroupBallot(accept);
+	uint count = subgroupBallotBitCount(ballot);
+
+	// One atomic per subgroup to reserve space in the compacted list
+	uint base = 0;
+
+	if (subgroupElect() && count > 0)
+		base = atomicAdd(visibleCount, count);
+
+	base = subgroupBroadcastFirst(base);
+
+	uint index = base + subgroupBallotExclusiveBitCount(ballot);
+
+	if (accept)
+	{
+		meshletList[index] = mi;
+
+		drawCommands[index].indexCount = uint(meshlets[mi].triangleCount) * 3;
+		drawCommands[index].instanceCount = 1;
+		drawCommands[index].firstIndex = meshlets[mi].indexOffset;
+		drawCommands[index].vertexOffset = int32_t(meshlets[mi].vertexOffset); // 16-bit indices are relative to the meshlet's index chunk
+		drawCommands[index].firstInstance = mi; // lets the vertex stage recover the meshlet index
+
+		// Each task workgroup consumes 32 consecutive entries of the meshlet list
+		if (index % 32 == 0)
+			atomicAdd(taskCommand.taskCount, 1);
+	}
+
+	if (CULL_STATS)
+	{
+		// Totals are reduced across the subgroup so that each counter takes one atomic per subgroup
+		uint testedCount = subgroupBallotBitCount(subgroupBallot(tested));
+		uint coneCount = subgroupBallotBitCount(subgroupBallot(coneCulled));
+		uint frustumCount = subgroupBallotBitCount(subgroupBallot(frustumCulled));
+		uint triangleCount = ballotSum8(accept ? uint(meshlets[mi].triangleCount) : 0);
+
+		if (subgroupElect())
+		{
+			atomicAdd(stats.meshletsTested, testedCount);
+			atomicAdd(stats.meshletsConeCulled, coneCount);
+			atomicAdd(stats.meshletsFrustumCulled, frustumCount);
+			atomicAdd(stats.meshletsSoftware, softwareCount);
+			atomicAdd(stats.trianglesEmitted, triangleCount);
+		}
+	}
+}
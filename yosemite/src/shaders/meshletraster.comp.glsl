@@ -0,0 +1,107 @@
+#version 460
+
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+#extension GL_EXT_shader_atomic_int64 : require
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
+
+layout(local_size_x = 32) in;
+
+layout(push_constant) uniform block
+{
+	uvec2 imageSize;
+};
+
+layout(binding = 0) readonly buffer Positions
+{
+	VertexPosition positions[];
+};
+
+layout(binding = 1) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+layout(binding = 2) readonly buffer SoftwareList
+{
+	uint32_t softwareList[];
+};
+
+layout(binding = 3) buffer Visibility
+{
+	uint64_t visibility[];
+};
+
+shared vec3 screenVertices[64];
+
+uint meshletIndex(uint mi, uint index)
+{
+	return (meshlets[mi].indicesPacked[index / 4] >> ((index % 4) * 8)) & 0xff;
+}
+
+float edge(vec2 a, vec2 b, vec2 p)
+{
+	return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+void main()
+{
+	uint ti = gl_LocalInvocationID.x;
+	uint mi = softwareList[gl_WorkGroupID.x];
+
+	uint vertexCount = meshlets[mi].vertexCount;
+	uint triangleCount = meshlets[mi].triangleCount;
+
+	// Same transform as meshvis.vert / meshletvis.mesh, followed by the viewport transform
+	for (uint i = ti; i < vertexCount; i += 32)
+	{
+		uint vi = meshlets[mi].vertices[i];
+
+		vec2 position = vec2(positions[vi].vx, -positions[vi].vy);
+
+		screenVertices[i] = vec3((position * 0.5 + 0.5) * vec2(imageSize), positions[vi].vz * 0.5 + 0.5);
+	}
+
+	barrier();
+
+	for (uint t = ti; t < triangleCount; t += 32)
+	{
+		vec3 a = screenVertices[meshletIndex(mi, t * 3 + 0)];
+		vec3 b = screenVertices[meshletIndex(mi, t * 3 + 1)];
+		vec3 c = screenVertices[meshletIndex(mi, t * 3 + 2)];
+
+		// Framebuffer y points down, so counter-clockwise front faces have negative area; matches VK_CULL_MODE_BACK_BIT
+		float area = edge(a.xy, b.xy, c.xy);
+
+		if (area >= 0)
+			continue;
+
+		vec2 bmin = max(floor(min(min(a.xy, b.xy), c.xy)), vec2(0));
+		vec2 bmax = min(ceil(max(max(a.xy, b.xy), c.xy)), vec2(imageSize) - 1);
+
+		uint payload = (mi << 7) | t;
+
+		for (float y = bmin.y; y <= bmax.y; y += 1)
+			for (float x = bmin.x; x <= bmax.x; x += 1)
+			{
+				vec2 p = vec2(x, y) + 0.5;
+
+				float wa = edge(b.xy, c.xy, p);
+				float wb = edge(c.xy, a.xy, p);
+				float wc = edge(a.xy, b.xy, p);
+
+				if (wa > 0 || wb > 0 || wc > 0)
+					continue;
+
+				float depth = (a.z * wa + b.z * wb + c.z * wc) / area;
+
+				if (depth < 0 || depth > 1)
+					continue;
+
+				// Larger depth is closer (VK_COMPARE_OP_GREATER), so atomicMax keeps the nearest triangle
+				atomicMax(visibility[uint(y) * imageSize.x + uint(x)], (uint64_t(floatBitsToUint(depth)) << 32) | payload);
+			}
+	}
+}
@@ -0,0 +1,79 @@
+#version 460
+
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+#extension GL_NV_mesh_shader : require
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
+
+// Multiview variant of meshlet.mesh: vertices are fetched once and transformed for every view the task shader found the meshlet visible in
+layout(local_size_x = 32, local_size_x_id = 2) in;
+layout(triangles, max_vertices = 64, max_primitives = 124) out;
+
+layout(binding = 0) readonly buffer Positions
+{
+	VertexPosition positions[];
+};
+
+layout(binding = 1) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+layout(binding = 5) readonly buffer Attributes
+{
+	VertexAttributes attributes[];
+};
+
+layout(binding = 7) readonly buffer Views
+{
+	View views[];
+};
+
+in taskNV block
+{
+	uint32_t meshletIndices[32];
+	uint32_t viewMasks[32];
+};
+
+layout(location = 0) out vec4 vColor[];
+
+void main()
+{
+	uint ti = gl_LocalInvocationID.x;
+	uint mi = meshletIndices[gl_WorkGroupID.x];
+	uint mask = viewMasks[gl_WorkGroupID.x];
+
+	uint vertexCount = meshlets[mi].vertexCount;
+	uint triangleCount = meshlets[mi].triangleCount;
+	uint indexCount = triangleCount * 3;
+
+	for (uint i = ti; i < vertexCount; i += gl_WorkGroupSize.x)
+	{
+		uint vi = meshlets[mi].vertices[i];
+
+		vec4 position = vec4(positions[vi].vx, positions[vi].vy, positions[vi].vz, 1.0);
+		vec3 normal = vec3(attributes[vi].nx, attributes[vi].ny, attributes[vi].nz);
+
+		for (uint v = 0; v < gl_MeshViewCountNV; ++v)
+		{
+			uint view = gl_MeshViewIndicesNV[v];
+
+			// Outside of the clip volume on every axis, so all triangles of the meshlet are rejected in views that culled it
+			gl_MeshVerticesNV[i].gl_PositionPerViewNV[v] = (mask & (1 << view)) != 0 ? views[view].transform * position : vec4(2.0, 2.0, 2.0, 1.0);
+		}
+
+		vColor[i] = vec4(normal * 0.5 + 0.5, 1.0);
+	}
+
+	uint indexGroupCount = (indexCount + 3) / 4;
+
+	for (uint i = ti; i < indexGroupCount; i += gl_WorkGroupSize.x)
+	{
+		writePackedPrimitiveIndices4x8NV(i * 4, meshlets[mi].indicesPacked[i]);
+	}
+
+	if (ti == 0)
+		gl_PrimitiveCountNV = uint(meshlets[mi].triangleCount);
+}
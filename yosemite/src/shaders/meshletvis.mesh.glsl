@@ -0,0 +1,68 @@
+
+#version 460
+
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+#extension GL_NV_mesh_shader : require
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
+
+// Workgroup size is specialized per device (MeshletConfig::meshWorkgroupSize); output limits match kMeshletMaxVertices/kMeshletMaxTriangles
+layout(local_size_x = 32, local_size_x_id = 2) in;
+layout(triangles, max_vertices = 64, max_primitives = 124) out;
+
+layout(binding = 0) readonly buffer Positions
+{
+	VertexPosition positions[];
+};
+
+layout(binding = 1) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+in taskNV block
+{
+	uint32_t meshletIndices[32];
+	uint32_t viewMasks[32]; // only written for multiview, see meshletview.mesh
+};
+
+layout(location = 0) flat out uint vMeshletIndex[];
+
+void main()
+{
+	uint ti = gl_LocalInvocationID.x;
+	uint mi = meshletIndices[gl_WorkGroupID.x];
+
+	uint vertexCount = meshlets[mi].vertexCount;
+	uint triangleCount = meshlets[mi].triangleCount;
+	uint indexCount = triangleCount * 3;
+
+	for (uint i = ti; i < vertexCount; i += gl_WorkGroupSize.x)
+	{
+		uint vi = meshlets[mi].vertices[i];
+
+		vec3 position = vec3(positions[vi].vx, -positions[vi].vy, positions[vi].vz * 0.5 + 0.5);
+
+		gl_MeshVerticesNV[i].gl_Position = vec4(position, 1.0);
+
+		vMeshletIndex[i] = mi;
+	}
+
+	uint indexGroupCount = (indexCount + 3) / 4;
+
+	for (uint i = ti; i < indexGroupCount; i += gl_WorkGroupSize.x)
+	{
+		writePackedPrimitiveIndices4x8NV(i * 4, meshlets[mi].indicesPacked[i]);
+	}
+
+	// Triangle index within the meshlet; combined with vMeshletIndex into the visibility payload
+	for (uint i = ti; i < triangleCount; i += gl_WorkGroupSize.x)
+	{
+		gl_MeshPrimitivesNV[i].gl_PrimitiveID = int(i);
+	}
+
+	if (ti == 0)
+		gl_PrimitiveCountNV = uint(meshlets[mi].triangleCount);
+}
@@ -0,0 +1,12 @@
+
+#version 460
+
+layout(location = 0) flat in uint vMeshletIndex;
+
+layout(location = 0) out uint fPayload;
+
+void main()
+{
+	// 25 bits of meshlet index, 7 bits of triangle index (up to 124 triangles per meshlet)
+	fPayload = (vMeshletIndex << 7) | uint(gl_PrimitiveID);
+}
@@ -0,0 +1,27 @@
+
+#version 460
+
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
+
+layout(binding = 0) readonly buffer Positions
+{
+	VertexPosition positions[];
+};
+
+layout(location = 0) flat out uint vMeshletIndex;
+
+void main()
+{
+	VertexPosition v = positions[gl_VertexIndex];
+
+	vec3 position = vec3(v.vx, -v.vy, v.vz * 0.5 + 0.5);
+
+	gl_Position = vec4(position, 1.0);
+
+	// meshletcull.comp emits one draw per meshlet with firstInstance set to the meshlet index
+	vMeshletIndex = gl_InstanceIndex;
+}
@@ -0,0 +1,28 @@
+#version 460
+
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+#extension GL_EXT_shader_atomic_int64 : require
+
+// Depth test has to reject fragments before the atomic, otherwise occluded fragments still write
+layout(early_fragment_tests) in;
+
+layout(push_constant) uniform block
+{
+	uint imageWidth;
+};
+
+layout(binding = 4) buffer Visibility
+{
+	uint64_t visibility[];
+};
+
+layout(location = 0) flat in uint vMeshletIndex;
+
+void main()
+{
+	uint payload = (vMeshletIndex << 7) | uint(gl_PrimitiveID);
+	uvec2 pos = uvec2(gl_FragCoord.xy);
+
+	// Same encoding as meshletraster.comp so that both rasterizers resolve against each other
+	atomicMax(visibility[pos.y * imageWidth + pos.x], (uint64_t(floatBitsToUint(gl_FragCoord.z)) << 32) | payload);
+}
@@ -0,0 +1,46 @@
+#ifndef VISIBILITY_H_
+#define VISIBILITY_H_ 1
+
+// Expects Positions/Attributes/Meshlets buffers named positions/attributes/meshlets and a uvec2 imageSize to be declared by the includer
+
+uint meshletVertex(uint mi, uint index)
+{
+	uint local = (meshlets[mi].indicesPacked[index / 4] >> ((index % 4) * 8)) & 0xff;
+
+	return meshlets[mi].vertices[local];
+}
+
+vec2 screenPosition(VertexPosition v)
+{
+	// Same transform as the geometry stages, followed by the viewport transform
+	vec2 position = vec2(v.vx, -v.vy);
+
+	return (position * 0.5 + 0.5) * vec2(imageSize);
+}
+
+vec4 shadeTriangle(uint mi, uint ti, vec2 p)
+{
+	uint ia = meshletVertex(mi, ti * 3 + 0);
+	uint ib = meshletVertex(mi, ti * 3 + 1);
+	uint ic = meshletVertex(mi, ti * 3 + 2);
+
+	vec2 pa = screenPosition(positions[ia]);
+	vec2 pb = screenPosition(positions[ib]);
+	vec2 pc = screenPosition(positions[ic]);
+
+	// Screen-space barycentrics; there is no perspective divide so no correction is needed
+	float area = (pb.x - pa.x) * (pc.y - pa.y) - (pb.y - pa.y) * (pc.x - pa.x);
+	float wb = ((p.x - pa.x) * (pc.y - pa.y) - (p.y - pa.y) * (pc.x - pa.x)) / area;
+	float wc = ((pb.x - pa.x) * (p.y - pa.y) - (pb.y - pa.y) * (p.x - pa.x)) / area;
+	float wa = 1.0 - wb - wc;
+
+	VertexAttributes va = attributes[ia];
+	VertexAttributes vb = attributes[ib];
+	VertexAttributes vc = attributes[ic];
+
+	vec3 normal = vec3(va.nx, va.ny, va.nz) * wa + vec3(vb.nx, vb.ny, vb.nz) * wb + vec3(vc.nx, vc.ny, vc.nz) * wc;
+
+	return vec4(normal * 0.5 + 0.5, 1.0);
+}
+
+#endif
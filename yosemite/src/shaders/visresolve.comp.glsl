@@ -0,0 +1,56 @@
+
+#version 460
+
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(push_constant) uniform block
+{
+	uvec2 imageSize;
+};
+
+layout(binding = 0) readonly buffer Positions
+{
+	VertexPosition positions[];
+};
+
+layout(binding = 1) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+layout(binding = 2, r32ui) uniform readonly uimage2D visibilityImage;
+layout(binding = 3, rgba8) uniform writeonly image2D outputImage;
+
+layout(binding = 4) readonly buffer Attributes
+{
+	VertexAttributes attributes[];
+};
+
+#include "visibility.h"
+
+void main()
+{
+	uvec2 pos = gl_GlobalInvocationID.xy;
+
+	if (pos.x >= imageSize.x || pos.y >= imageSize.y)
+		return;
+
+	uint payload = imageLoad(visibilityImage, ivec2(pos)).x;
+
+	if (payload == ~0u)
+	{
+		imageStore(outputImage, ivec2(pos), vec4(0.1, 0.1, 0.15, 1.0));
+		return;
+	}
+
+	uint mi = payload >> 7;
+	uint ti = payload & 127;
+
+	imageStore(outputImage, ivec2(pos), shadeTriangle(mi, ti, vec2(pos) + 0.5));
+}